@@ -24,7 +24,9 @@
 #include "kgthemeprovider.h"
 
 #include <QtCore/QCoreApplication>
+#include <QtCore/QCryptographicHash>
 #include <QtCore/QDateTime>
+#include <QtCore/QFile>
 #include <QtCore/QFileInfo>
 #include <QtCore/QScopedPointer>
 #include <QtGui/QPainter>
@@ -44,6 +46,62 @@ static const QString cacheName(QByteArray theme)
 		.arg(appName).arg(QString::fromUtf8(theme));
 }
 
+//Name of the cache for KGameRenderer::UseSharedDiskCache. Since the cache keys
+//contain everything else that determines the rendering result, the name only
+//needs to identify the SVG contents (and the frame naming, which influences
+//the cached frame counts). Returns an empty string if the file is unreadable.
+static QString sharedCacheName(const QString& graphicsPath, const QString& frameSuffix, int frameBaseIndex)
+{
+	const QFileInfo fileInfo(graphicsPath);
+	if (!fileInfo.isReadable())
+	{
+		return QString();
+	}
+	//Hashing the whole SVG file on every theme load would be expensive, so
+	//the content hash is remembered for each path, timestamp and size. This
+	//small cache is shared by all applications and survives restarts.
+	static KSharedDataCache hashCache(QString::fromLatin1("kgamerenderer-shared-names"), 64 << 10);
+	const QString fileKey = QString::fromLatin1("%1-%2-%3")
+		.arg(fileInfo.lastModified().toMSecsSinceEpoch()).arg(fileInfo.size())
+		.arg(fileInfo.absoluteFilePath());
+	QByteArray contentHash;
+	if (!hashCache.find(fileKey, &contentHash))
+	{
+		QFile file(graphicsPath);
+		if (!file.open(QIODevice::ReadOnly))
+		{
+			return QString();
+		}
+		QCryptographicHash hash(QCryptographicHash::Sha1);
+		hash.addData(&file);
+		contentHash = hash.result();
+		hashCache.insert(fileKey, contentHash);
+	}
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	hash.addData(contentHash);
+	hash.addData(frameSuffix.toUtf8());
+	hash.addData(QByteArray::number(frameBaseIndex));
+	return QString::fromLatin1("kgamerenderer-shared-%1")
+		.arg(QString::fromLatin1(hash.result().toHex()));
+}
+
+//Returns the size of the mipmap level from which a pixmap of the given size is
+//downscaled. The larger side is rounded up to a power of two, and the other
+//side is scaled by the same factor to keep the aspect ratio. Returns an
+//invalid size if the pixmap is too large for mipmaps.
+static QSize mipLevelSize(const QSize& size)
+{
+	static const int maxLevelSize = 4096;
+	const int side = qMax(size.width(), size.height());
+	int levelSide = 1;
+	while (levelSide < side)
+		levelSide *= 2;
+	if (levelSide > maxLevelSize)
+		return QSize();
+	const qreal factor = qreal(levelSide) / side;
+	return QSize(qRound(size.width() * factor), qRound(size.height() * factor));
+}
+
 KGameRendererPrivate::KGameRendererPrivate(KgThemeProvider* provider, unsigned cacheSize, KGameRenderer* parent)
 	: m_parent(parent)
 	, m_provider(provider)
@@ -58,7 +116,11 @@ KGameRendererPrivate::KGameRendererPrivate(KgThemeProvider* provider, unsigned c
 	, m_frameBaseIndex(0)
 	, m_defaultPrimaryView(0)
 	, m_rendererPool(&m_workerPool)
+	, m_themeSwitchPending(false)
+	, m_stagingThemeSwitch(false)
+	, m_themeGeneration(0)
 	, m_imageCache(0)
+	, m_bundle(new KGRInternal::ThemeBundle)
 {
 	qRegisterMetaType<KGRInternal::Job*>();
 	
@@ -96,6 +158,7 @@ KGameRenderer::~KGameRenderer()
 	//cleanup own stuff
 	d->m_workerPool.waitForDone();
 	delete d->m_imageCache;
+	delete d->m_bundle;
 	delete d;
 }
 
@@ -145,7 +208,7 @@ void KGameRenderer::setStrategyEnabled(KGameRenderer::Strategy strategy, bool en
 	{
 		d->m_strategies &= ~strategy;
 	}
-	if (strategy == KGameRenderer::UseDiskCache && oldEnabled != enabled)
+	if ((strategy == KGameRenderer::UseDiskCache || strategy == KGameRenderer::UseSharedDiskCache) && oldEnabled != enabled)
 	{
 		//reload theme
 		const KgTheme* theme = d->m_currentTheme;
@@ -177,16 +240,61 @@ void KGameRendererPrivate::_k_setTheme(const KgTheme* theme)
 			m_provider->setCurrentTheme(defaultTheme);
 		}
 	}
-	//announce change to KGameRendererClients
+	//announce change to KGameRendererClients: They keep their old pixmaps
+	//until all new pixmaps are available, see commitThemeSwitch().
+	m_themeSwitchPending = true;
+	m_stagedPixmaps.clear();
+	m_stagingThemeSwitch = true;
 	QHash<KGameRendererClient*, QString>::iterator it1 = m_clients.begin(), it2 = m_clients.end();
 	for (; it1 != it2; ++it1)
 	{
 		it1.value().clear(); //because the pixmap is outdated
 		it1.key()->d->fetchPixmap();
 	}
+	m_stagingThemeSwitch = false;
+	//only wait for the jobs started by the switch itself; requests made later
+	//(e.g. by animations) must not delay the switch
+	m_themeSwitchRequests = m_pendingRequests.toSet();
+	//if everything could be served from the caches, swap immediately
+	if (m_themeSwitchRequests.isEmpty())
+	{
+		commitThemeSwitch();
+	}
 	emit m_parent->themeChanged(m_currentTheme);
 }
 
+void KGameRendererPrivate::deliverPixmap(const QPixmap& pixmap, KGameRendererClient* client, bool staged)
+{
+	if (staged)
+	{
+		m_stagedPixmaps.insert(client, pixmap);
+	}
+	else
+	{
+		//a staged pixmap of this client is outdated by this one
+		m_stagedPixmaps.remove(client);
+		client->receivePixmap(pixmap);
+	}
+}
+
+void KGameRendererPrivate::commitThemeSwitch()
+{
+	m_themeSwitchPending = false;
+	m_themeSwitchRequests.clear();
+	//take the list first because receivePixmap() may cause further requests
+	const QHash<KGameRendererClient*, QPixmap> staged = m_stagedPixmaps;
+	m_stagedPixmaps.clear();
+	QHash<KGameRendererClient*, QPixmap>::const_iterator it1 = staged.constBegin(), it2 = staged.constEnd();
+	for (; it1 != it2; ++it1)
+	{
+		//clients may have been deleted by other receivePixmap() calls
+		if (m_clients.contains(it1.key()))
+		{
+			it1.key()->receivePixmap(it1.value());
+		}
+	}
+}
+
 bool KGameRendererPrivate::setTheme(const KgTheme* theme)
 {
 	QLoggingCategory::setFilterRules(QLatin1Literal("games.lib.debug = true"));
@@ -195,25 +303,54 @@ bool KGameRendererPrivate::setTheme(const KgTheme* theme)
 	{
 		return false;
 	}
+	const uint svgTimestamp = qMax(
+		QFileInfo(theme->graphicsPath()).lastModified().toTime_t(),
+		theme->property("_k_themeDescTimestamp").value<uint>()
+	);
+	//look for a precompiled bundle; if there is one, the SVG file does not
+	//need to be parsed until a sprite is requested which is not in the bundle
+	QScopedPointer<KGRInternal::ThemeBundle> bundle(new KGRInternal::ThemeBundle);
+	const bool haveBundle = bundle->load(KGRInternal::ThemeBundle::pathForGraphics(theme->graphicsPath()), svgTimestamp);
+	if (haveBundle)
+	{
+		qCDebug(GAMES_LIB) << "Using precompiled theme bundle";
+	}
 	//open cache (and SVG file, if necessary)
 	if (m_strategies & KGameRenderer::UseDiskCache)
 	{
 		QScopedPointer<KImageCache> oldCache(m_imageCache);
-		const QString imageCacheName = cacheName(theme->identifier());
+		QString imageCacheName;
+		if (m_strategies & KGameRenderer::UseSharedDiskCache)
+		{
+			imageCacheName = sharedCacheName(theme->graphicsPath(), m_frameSuffix, m_frameBaseIndex);
+		}
+		const bool sharedCache = !imageCacheName.isEmpty();
+		if (!sharedCache)
+		{
+			imageCacheName = cacheName(theme->identifier());
+		}
 		m_imageCache = new KImageCache(imageCacheName, m_cacheSize);
 		m_imageCache->setPixmapCaching(false); //see big comment in KGRPrivate class declaration
 		//check timestamp of cache vs. last write access to theme/SVG
-		const uint svgTimestamp = qMax(
-			QFileInfo(theme->graphicsPath()).lastModified().toTime_t(),
-			theme->property("_k_themeDescTimestamp").value<uint>()
-		);
+		//A shared cache cannot be outdated because its name is derived from
+		//the SVG contents. Another process may have a copy of the same file
+		//with a different timestamp, so only check whether the SVG file has
+		//been validated for this cache at all.
+		const uint requiredTimestamp = sharedCache ? 1 : svgTimestamp;
 		QByteArray buffer;
 		if (!m_imageCache->find(QString::fromLatin1("kgr_timestamp"), &buffer))
 			buffer = "0";
 		const uint cacheTimestamp = buffer.toInt();
 		//try to instantiate renderer immediately if the cache does not exist or is outdated
 		//FIXME: This logic breaks if the cache evicts the "kgr_timestamp" key. We need additional API in KSharedDataCache to make sure that this key does not get evicted.
-		if (cacheTimestamp < svgTimestamp)
+		if (cacheTimestamp < requiredTimestamp && haveBundle)
+		{
+			//the bundle has been created from a valid SVG file
+			m_rendererPool.setPath(theme->graphicsPath());
+			m_imageCache->clear();
+			m_imageCache->insert(QString::fromLatin1("kgr_timestamp"), QByteArray::number(requiredTimestamp));
+		}
+		else if (cacheTimestamp < requiredTimestamp)
 		{
 			qCDebug(GAMES_LIB) << "Theme newer than cache, checking SVG";
 			QScopedPointer<QSvgRenderer> renderer(new QSvgRenderer(theme->graphicsPath()));
@@ -221,7 +358,7 @@ bool KGameRendererPrivate::setTheme(const KgTheme* theme)
 			{
 				m_rendererPool.setPath(theme->graphicsPath(), renderer.take());
 				m_imageCache->clear();
-				m_imageCache->insert(QString::fromLatin1("kgr_timestamp"), QByteArray::number(svgTimestamp));
+				m_imageCache->insert(QString::fromLatin1("kgr_timestamp"), QByteArray::number(requiredTimestamp));
 			}
 			else
 			{
@@ -240,9 +377,13 @@ bool KGameRendererPrivate::setTheme(const KgTheme* theme)
 	}
 	else // !(m_strategies & KGameRenderer::UseDiskCache) -> no cache is used
 	{
-		//load SVG file
-		QScopedPointer<QSvgRenderer> renderer(new QSvgRenderer(theme->graphicsPath()));
-		if (renderer->isValid())
+		//load SVG file (unless the bundle vouches for it)
+		QScopedPointer<QSvgRenderer> renderer(haveBundle ? 0 : new QSvgRenderer(theme->graphicsPath()));
+		if (haveBundle)
+		{
+			m_rendererPool.setPath(theme->graphicsPath());
+		}
+		else if (renderer->isValid())
 		{
 			m_rendererPool.setPath(theme->graphicsPath(), renderer.take());
 		}
@@ -257,8 +398,15 @@ bool KGameRendererPrivate::setTheme(const KgTheme* theme)
 	}
 	//clear in-process caches
 	m_pixmapCache.clear();
+	m_mipLevelCache.clear();
 	m_frameCountCache.clear();
 	m_boundsCache.clear();
+	delete m_bundle;
+	m_bundle = bundle.take();
+	//results of jobs for the old theme may still be queued; discard them
+	m_pendingRequests.clear();
+	m_prewarmRequests.clear();
+	++m_themeGeneration;
 	//done
 	m_currentTheme = theme;
 	return true;
@@ -316,11 +464,12 @@ int KGameRenderer::frameCount(const QString& key) const
 	{
 		return it.value();
 	}
-	//look up in shared cache (if SVG is not yet loaded)
+	//look up in precompiled bundle
 	int count = -1;
-	bool countFound = false;
+	bool countFound = d->m_bundle->findFrameCount(key, d->m_frameSuffix, d->m_frameBaseIndex, &count);
+	//look up in shared cache (if SVG is not yet loaded)
 	const QString cacheKey = d->m_frameCountPrefix + key;
-	if (d->m_rendererPool.hasAvailableRenderers() && (d->m_strategies & KGameRenderer::UseDiskCache))
+	if (!countFound && d->m_rendererPool.hasAvailableRenderers() && (d->m_strategies & KGameRenderer::UseDiskCache))
 	{
 		QByteArray buffer;
 		if (d->m_imageCache->find(cacheKey, &buffer))
@@ -373,11 +522,12 @@ QRectF KGameRenderer::boundsOnSprite(const QString& key, int frame) const
 	{
 		return it.value();
 	}
-	//look up in shared cache (if SVG is not yet loaded)
+	//look up in precompiled bundle
 	QRectF bounds;
-	bool boundsFound = false;
+	bool boundsFound = d->m_bundle->findBounds(elementKey, &bounds);
+	//look up in shared cache (if SVG is not yet loaded)
 	const QString cacheKey = d->m_boundsPrefix + elementKey;
-	if (!d->m_rendererPool.hasAvailableRenderers() && (d->m_strategies & KGameRenderer::UseDiskCache))
+	if (!boundsFound && !d->m_rendererPool.hasAvailableRenderers() && (d->m_strategies & KGameRenderer::UseDiskCache))
 	{
 		QByteArray buffer;
 		if (d->m_imageCache->find(cacheKey, &buffer))
@@ -420,12 +570,82 @@ QPixmap KGameRenderer::spritePixmap(const QString& key, const QSize& size, int f
 	return result;
 }
 
+void KGameRenderer::prewarm(const QStringList& keys, const QList<QSize>& sizes)
+{
+	if (!(d->m_strategies & KGameRenderer::UseDiskCache) || !(d->m_strategies & KGameRenderer::UseRenderingThreads))
+	{
+		return;
+	}
+	//ensure that some theme is loaded
+	if (!d->m_currentTheme)
+	{
+		d->_k_setTheme(d->m_provider->currentTheme());
+	}
+	foreach (const QString& key, keys)
+	{
+		//collect element keys for all frames of this sprite
+		QStringList elementKeys;
+		const int frameCount = this->frameCount(key);
+		if (frameCount < 0)
+		{
+			continue;
+		}
+		else if (frameCount == 0)
+		{
+			elementKeys << key;
+		}
+		else
+		{
+			for (int frame = d->m_frameBaseIndex; frame < d->m_frameBaseIndex + frameCount; ++frame)
+			{
+				elementKeys << d->spriteFrameKey(key, frame);
+			}
+		}
+		foreach (const QString& elementKey, elementKeys)
+		{
+			foreach (const QSize& size, sizes)
+			{
+				if (size.isEmpty())
+				{
+					continue;
+				}
+				//with mipmaps, only the mipmap levels need to be cached
+				QSize renderSize = size;
+				if (d->m_strategies & KGameRenderer::UseMipmaps)
+				{
+					const QSize levelSize = mipLevelSize(size);
+					if (levelSize.isValid())
+					{
+						renderSize = levelSize;
+					}
+				}
+				const QString cacheKey = d->m_sizePrefix.arg(renderSize.width()).arg(renderSize.height()) + elementKey;
+				QImage bundleImage;
+				if (d->m_pixmapCache.contains(cacheKey) || d->m_imageCache->contains(cacheKey) || d->m_bundle->findImage(cacheKey, &bundleImage)
+					|| d->m_pendingRequests.contains(cacheKey) || d->m_prewarmRequests.contains(cacheKey))
+				{
+					continue;
+				}
+				KGRInternal::Job* job = new KGRInternal::Job;
+				job->rendererPool = &d->m_rendererPool;
+				job->cacheKey = cacheKey;
+				job->elementKey = elementKey;
+				job->spec = KGRInternal::ClientSpec(key, -1, renderSize);
+				job->themeGeneration = d->m_themeGeneration;
+				//lower priority than client requests (which have priority 0)
+				d->m_workerPool.start(new KGRInternal::Worker(job, false, d), -1);
+				d->m_prewarmRequests << cacheKey;
+			}
+		}
+	}
+}
+
 //Helper function for KGameRendererPrivate::requestPixmap.
 void KGameRendererPrivate::requestPixmap__propagateResult(const QPixmap& pixmap, KGameRendererClient* client, QPixmap* synchronousResult)
 {
 	if (client)
 	{
-		client->receivePixmap(pixmap);
+		deliverPixmap(pixmap, client, m_stagingThemeSwitch);
 	}
 	if (synchronousResult)
 	{
@@ -443,13 +663,14 @@ void KGameRendererPrivate::requestPixmap(const KGRInternal::ClientSpec& spec, KG
 		return;
 	}
 	const QString elementKey = spriteFrameKey(spec.spriteKey, spec.frame);
-	QString cacheKey = m_sizePrefix.arg(spec.size.width()).arg(spec.size.height()) + elementKey;
+	QString colorsKey;
 	QHash<QColor, QColor>::const_iterator it1 = spec.customColors.constBegin(), it2 = spec.customColors.constEnd();
 	static const QString colorSuffix(QLatin1String( "-%1-%2" ));
 	for (; it1 != it2; ++it1)
 	{
-		cacheKey += colorSuffix.arg(it1.key().rgba()).arg(it1.value().rgba());
+		colorsKey += colorSuffix.arg(it1.key().rgba()).arg(it1.value().rgba());
 	}
+	const QString cacheKey = m_sizePrefix.arg(spec.size.width()).arg(spec.size.height()) + elementKey + colorsKey;
 	//check if update is needed
 	if (client)
 	{
@@ -471,6 +692,15 @@ void KGameRendererPrivate::requestPixmap(const KGRInternal::ClientSpec& spec, KG
 		requestPixmap__propagateResult(it.value(), client, synchronousResult);
 		return;
 	}
+	//try to serve from precompiled bundle
+	QImage bundleImage;
+	if (m_bundle->findImage(cacheKey, &bundleImage))
+	{
+		const QPixmap pix = QPixmap::fromImage(bundleImage);
+		m_pixmapCache.insert(cacheKey, pix);
+		requestPixmap__propagateResult(pix, client, synchronousResult);
+		return;
+	}
 	//try to serve from low-speed cache
 	if (m_strategies & KGameRenderer::UseDiskCache)
 	{
@@ -482,17 +712,50 @@ void KGameRendererPrivate::requestPixmap(const KGRInternal::ClientSpec& spec, KG
 			return;
 		}
 	}
+	//try to downscale from a cached mipmap level
+	QString mipLevelKey;
+	const QSize levelSize = (m_strategies & KGameRenderer::UseMipmaps) ? mipLevelSize(spec.size) : QSize();
+	if (levelSize.isValid() && levelSize != spec.size)
+	{
+		mipLevelKey = m_sizePrefix.arg(levelSize.width()).arg(levelSize.height()) + elementKey + colorsKey;
+		QImage level;
+		QHash<QString, QImage>::const_iterator levelIt = m_mipLevelCache.constFind(mipLevelKey);
+		if (levelIt != m_mipLevelCache.constEnd())
+		{
+			level = levelIt.value();
+		}
+		if (!level.isNull() || m_bundle->findImage(mipLevelKey, &level)
+			|| ((m_strategies & KGameRenderer::UseDiskCache) && m_imageCache->findImage(mipLevelKey, &level)))
+		{
+			const QPixmap pix = QPixmap::fromImage(level.scaled(spec.size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+			m_pixmapCache.insert(cacheKey, pix);
+			requestPixmap__propagateResult(pix, client, synchronousResult);
+			return;
+		}
+	}
 	//if asynchronous request, is such a rendering job already running?
 	if (client && m_pendingRequests.contains(cacheKey))
 	{
 		return;
 	}
+	//is this pixmap already being rendered by prewarm()?
+	if (client && m_prewarmRequests.remove(cacheKey))
+	{
+		m_pendingRequests << cacheKey;
+		return;
+	}
 	//create job
 	KGRInternal::Job* job = new KGRInternal::Job;
 	job->rendererPool = &m_rendererPool;
 	job->cacheKey = cacheKey;
 	job->elementKey = elementKey;
 	job->spec = spec;
+	job->themeGeneration = m_themeGeneration;
+	if (!mipLevelKey.isEmpty())
+	{
+		job->mipLevelKey = mipLevelKey;
+		job->mipLevelSize = levelSize;
+	}
 	const bool synchronous = !client;
 	if (synchronous || !(m_strategies & KGameRenderer::UseRenderingThreads))
 	{
@@ -514,26 +777,55 @@ void KGameRendererPrivate::jobFinished(KGRInternal::Job* job, bool isSynchronous
 	//read job
 	const QString cacheKey = job->cacheKey;
 	const QImage result = job->result;
+	const QString mipLevelKey = job->mipLevelKey;
+	const QImage mipLevel = job->mipLevel;
+	const bool isStale = job->themeGeneration != m_themeGeneration;
 	delete job;
+	//the theme has been changed since this job was started
+	if (isStale)
+	{
+		return;
+	}
 	//check who wanted this pixmap
 	m_pendingRequests.removeAll(cacheKey);
+	m_prewarmRequests.remove(cacheKey);
+	const bool forThemeSwitch = m_stagingThemeSwitch || m_themeSwitchRequests.remove(cacheKey);
 	const QList<KGameRendererClient*> requesters = m_clients.keys(cacheKey);
 	//put result into image cache
+	bool needPixmap = true;
 	if (m_strategies & KGameRenderer::UseDiskCache)
 	{
-		m_imageCache->insertImage(cacheKey, result);
+		//with mipmaps, only the level is stored (it will serve many sizes)
+		if (mipLevelKey.isEmpty())
+		{
+			m_imageCache->insertImage(cacheKey, result);
+		}
+		else
+		{
+			m_imageCache->insertImage(mipLevelKey, mipLevel);
+		}
 		//convert result to pixmap (and put into pixmap cache) only if it is needed now
 		//This optimization saves the image-pixmap conversion for intermediate sizes which occur during smooth resize events or window initializations.
-		if (!isSynchronous && requesters.isEmpty())
+		needPixmap = isSynchronous || !requesters.isEmpty();
+	}
+	else if (!mipLevelKey.isEmpty())
+	{
+		//without disk cache, keep the level in memory to serve other sizes
+		m_mipLevelCache.insert(mipLevelKey, mipLevel);
+	}
+	if (needPixmap)
+	{
+		const QPixmap pixmap = QPixmap::fromImage(result);
+		m_pixmapCache.insert(cacheKey, pixmap);
+		foreach (KGameRendererClient* requester, requesters)
 		{
-			return;
+			deliverPixmap(pixmap, requester, forThemeSwitch);
 		}
 	}
-	const QPixmap pixmap = QPixmap::fromImage(result);
-	m_pixmapCache.insert(cacheKey, pixmap);
-	foreach (KGameRendererClient* requester, requesters)
+	//was this the last missing pixmap for the new theme?
+	if (m_themeSwitchPending && !m_stagingThemeSwitch && m_themeSwitchRequests.isEmpty())
 	{
-		requester->receivePixmap(pixmap);
+		commitThemeSwitch();
 	}
 }
 
@@ -550,7 +842,8 @@ static const uint transparentRgba = QColor(Qt::transparent).rgba();
 
 void KGRInternal::Worker::run()
 {
-	QImage image(m_job->spec.size, QImage::Format_ARGB32_Premultiplied);
+	const bool useMipLevel = !m_job->mipLevelKey.isEmpty();
+	QImage image(useMipLevel ? m_job->mipLevelSize : m_job->spec.size, QImage::Format_ARGB32_Premultiplied);
 	image.fill(transparentRgba);
 	QPainter* painter = 0;
 	QPaintDeviceColorProxy* proxy = 0;
@@ -573,7 +866,15 @@ void KGRInternal::Worker::run()
 	delete proxy;
 
 	//talk back to the main thread
-	m_job->result = image;
+	if (useMipLevel)
+	{
+		m_job->mipLevel = image;
+		m_job->result = image.scaled(m_job->spec.size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+	}
+	else
+	{
+		m_job->result = image;
+	}
 	QMetaObject::invokeMethod(
 		m_parent, "jobFinished", Qt::AutoConnection,
 		Q_ARG(KGRInternal::Job*, m_job), Q_ARG(bool, m_synchronous)
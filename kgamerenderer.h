@@ -110,7 +110,27 @@ class KDEGAMES_EXPORT KGameRenderer : public QObject
 			///If set, pixmap requests from KGameRendererClients will be
 			///handled asynchronously if possible. This is especially useful
 			///when many clients are requesting complex pixmaps at one time.
-			UseRenderingThreads = 1 << 1
+			UseRenderingThreads = 1 << 1,
+			///If set, sprites are rendered only in a few sizes (with the larger
+			///side rounded up to the next power of two, keeping the aspect
+			///ratio), and the requested size is produced by smoothly
+			///downscaling the next larger one. Only these mipmap levels are
+			///stored in the disk cache (or in memory without disk cache). This is
+			///useful for games that render many sprites in constantly changing
+			///sizes (e.g. card games while the window is resized), because
+			///resizes will then rarely need to render the SVG again. Not
+			///enabled by default.
+			///@since 4.14
+			UseMipmaps = 1 << 2,
+			///If set (in addition to UseDiskCache), the disk cache is not
+			///specific to the application, but identified by the contents of
+			///the SVG file. All applications that use the same SVG file (e.g.
+			///a card deck) with this strategy share their rendered pixmaps,
+			///also across concurrently running processes. The size of a shared
+			///cache is determined by the application that creates it. Not
+			///enabled by default.
+			///@since 4.14
+			UseSharedDiskCache = 1 << 3
 		};
 		Q_DECLARE_FLAGS(Strategies, Strategy)
 
@@ -168,8 +188,9 @@ class KDEGAMES_EXPORT KGameRenderer : public QObject
 		///only want to disable optimizations if the graphics are so simple that
 		///the optimisations create an overhead in your special case.
 		///
-		///If you disable UseDiskCache, you should do so before setTheme(),
-		///because changes to UseDiskCache cause a full theme reload.
+		///If you change UseDiskCache or UseSharedDiskCache, you should do so
+		///before setTheme(), because changes to these strategies cause a full
+		///theme reload.
 		void setStrategyEnabled(Strategy strategy, bool enabled = true);
 
 		///@return the KgTheme instance used by this renderer
@@ -212,7 +233,22 @@ class KDEGAMES_EXPORT KGameRenderer : public QObject
 		// The parentheses around QHash<QColor, QColor>() avoid compile
 		// errors on platforms with older gcc versions, e.g. OS X 10.6.
 		QPixmap spritePixmap(const QString& key, const QSize& size, int frame = -1, const QHash<QColor, QColor>& customColors = (QHash<QColor, QColor>())) const;
+		///Renders the given sprites in the given sizes into the disk cache,
+		///so that later requests for them can be served without touching the
+		///SVG file. For animated sprites, all frames are rendered.
+		///
+		///The rendering happens in the worker threads, after all pending
+		///requests from KGameRendererClients have been served. Call this
+		///e.g. after the main window has been shown, for the sprites that
+		///will be visible when the first game starts.
+		///@note This method does nothing unless both the UseDiskCache and the
+		///      UseRenderingThreads strategies are enabled.
+		///@since 4.14
+		void prewarm(const QStringList& keys, const QList<QSize>& sizes);
 	Q_SIGNALS:
+		///Emitted when the theme changes. Clients keep displaying the pixmaps
+		///of the old theme until all pixmaps for the new theme have been
+		///rendered, and then receive them together.
 		void themeChanged(const KgTheme* theme);
 		///This signal is never emitted. It is provided because QML likes to
 		///complain about properties without NOTIFY signals, even readonly ones.
@@ -23,10 +23,13 @@
 #include <QtCore/QMetaType>
 #include <QtCore/QMutex>
 #include <QtCore/QRunnable>
+#include <QtCore/QSet>
 #include <QtCore/QThreadPool>
 #include <QtSvg/QSvgRenderer>
 #include <KImageCache>
 
+#include "kgamerendererbundle_p.h"
+
 namespace KGRInternal
 {
 	//Describes the state of a KGameRendererClient.
@@ -86,6 +89,13 @@ namespace KGRInternal
 		ClientSpec spec;
 		QString cacheKey, elementKey;
 		QImage result;
+		//If mipLevelKey is set, the element is rendered in mipLevelSize, and
+		//the result is downscaled from this mipmap level.
+		QString mipLevelKey;
+		QSize mipLevelSize;
+		QImage mipLevel;
+		//used to discard results which arrive after a theme change
+		unsigned themeGeneration;
 	};
 
 	//Describes a worker thread.
@@ -115,6 +125,12 @@ class KGameRendererPrivate : public QObject
 		void requestPixmap(const KGRInternal::ClientSpec& spec, KGameRendererClient* client, QPixmap* synchronousResult = 0);
 	private:
 		inline void requestPixmap__propagateResult(const QPixmap& pixmap, KGameRendererClient* client, QPixmap* synchronousResult);
+		//Delivers a pixmap to the client, or holds it back until the pending
+		//theme switch is committed if it belongs to that switch.
+		void deliverPixmap(const QPixmap& pixmap, KGameRendererClient* client, bool staged);
+		//Hands all pixmaps held back during a theme switch to their clients
+		//in one pass, once the jobs started by the switch have finished.
+		void commitThemeSwitch();
 	public Q_SLOTS:
 		void jobFinished(KGRInternal::Job* job, bool isSynchronous); //NOTE: This is invoked from KGRInternal::Worker::run.
 	public:
@@ -133,8 +149,23 @@ class KGameRendererPrivate : public QObject
 
 		QHash<KGameRendererClient*, QString> m_clients; //maps client -> cache key of current pixmap
 		QStringList m_pendingRequests; //cache keys of pixmaps which are currently being rendered
+		QSet<QString> m_prewarmRequests; //cache keys of pixmaps which are being rendered by prewarm()
+
+		//While a theme switch is pending, clients keep showing the pixmaps of
+		//the old theme. The new pixmaps are collected in m_stagedPixmaps and
+		//handed out together when the last rendering job started by the
+		//switch (m_themeSwitchRequests) has finished, so that the user never
+		//sees a mixture of old and new sprites. Pixmaps requested after the
+		//switch are delivered normally.
+		bool m_themeSwitchPending;
+		bool m_stagingThemeSwitch; //while the clients fetch their new pixmaps
+		QSet<QString> m_themeSwitchRequests;
+		unsigned m_themeGeneration;
+		QHash<KGameRendererClient*, QPixmap> m_stagedPixmaps;
 
 		KImageCache* m_imageCache;
+		//optional precompiled bundle of the current theme (see kgrbundle tool)
+		KGRInternal::ThemeBundle* m_bundle;
 		//In multi-threaded scenarios, there are two possible ways to use KIC's
 		//pixmap cache.
 		//1. The worker renders a QImage and stores it in the cache. The main
@@ -156,6 +187,8 @@ class KGameRendererPrivate : public QObject
 		//As you see, implementing an own pixmap cache saves us one conversion.
 		//We therefore disable KIC's pixmap cache because we do not need it.
 		QHash<QString, QPixmap> m_pixmapCache;
+		//mipmap levels if the disk cache is disabled (see UseMipmaps)
+		QHash<QString, QImage> m_mipLevelCache;
 		QHash<QString, int> m_frameCountCache;
 		QHash<QString, QRectF> m_boundsCache;
 };
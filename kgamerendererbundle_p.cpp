@@ -0,0 +1,228 @@
+/***************************************************************************
+ *   Copyright 2014 KDE Games Team <kde-games-devel@kde.org>               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License          *
+ *   version 2 as published by the Free Software Foundation                *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "kgamerendererbundle_p.h"
+
+#include <QtCore/QDataStream>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+#include <QtCore/QSysInfo>
+
+static const quint32 bundleMagic = 0x4b475242; //"KGRB"
+static const quint32 bundleVersion = 2;
+//the pixel data is in the byte order of the machine that wrote the bundle
+static const quint32 bundleByteOrder = QSysInfo::ByteOrder;
+//magic + version + byte order + index offset
+static const qint64 bundleHeaderSize = 4 + 4 + 4 + 8;
+
+KGRInternal::ThemeBundle::ThemeBundle()
+	: m_data(0)
+	, m_size(0)
+	, m_frameBaseIndex(0)
+{
+}
+
+KGRInternal::ThemeBundle::~ThemeBundle()
+{
+	clear();
+}
+
+QString KGRInternal::ThemeBundle::pathForGraphics(const QString& graphicsPath)
+{
+	const QFileInfo fi(graphicsPath);
+	return fi.absolutePath() + QLatin1Char('/') + fi.completeBaseName() + QLatin1String(".kgrbundle");
+}
+
+bool KGRInternal::ThemeBundle::write(const QString& path, const KGRInternal::BundleData& data)
+{
+	//Other processes may have mapped the existing bundle (see load()), so it
+	//must not be truncated in place. QSaveFile writes a temporary file and
+	//renames it over the old bundle when everything has been written.
+	QSaveFile file(path);
+	if (!file.open(QIODevice::WriteOnly))
+	{
+		return false;
+	}
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_4_8);
+	//the index offset is filled in after the pixel data has been written
+	stream << bundleMagic << bundleVersion << bundleByteOrder << qint64(0);
+	//write pixel data (rows are stored without padding, and since each pixel
+	//takes 4 bytes, all images stay 4-byte aligned)
+	QList<QString> keys;
+	QList<ImageEntry> entries;
+	QHash<QString, QImage>::const_iterator it1 = data.images.constBegin(), it2 = data.images.constEnd();
+	for (; it1 != it2; ++it1)
+	{
+		const QImage image = it1.value().convertToFormat(QImage::Format_ARGB32_Premultiplied);
+		if (image.isNull())
+		{
+			continue;
+		}
+		ImageEntry entry;
+		entry.width = image.width();
+		entry.height = image.height();
+		entry.offset = file.pos();
+		for (int y = 0; y < entry.height; ++y)
+		{
+			file.write(reinterpret_cast<const char*>(image.constScanLine(y)), entry.width * 4);
+		}
+		keys << it1.key();
+		entries << entry;
+	}
+	//write index
+	const qint64 indexOffset = file.pos();
+	stream << quint32(data.svgTimestamp) << data.frameSuffix << qint32(data.frameBaseIndex);
+	stream << data.frameCounts << data.bounds;
+	stream << quint32(entries.count());
+	for (int i = 0; i < entries.count(); ++i)
+	{
+		const ImageEntry& entry = entries[i];
+		stream << keys[i] << qint32(entry.width) << qint32(entry.height) << entry.offset;
+	}
+	//fill in index offset
+	file.seek(12); //12 = size of magic, version and byte order
+	stream << indexOffset;
+	if (stream.status() != QDataStream::Ok)
+	{
+		file.cancelWriting();
+	}
+	return file.commit();
+}
+
+bool KGRInternal::ThemeBundle::load(const QString& path, uint svgTimestamp)
+{
+	clear();
+	m_file.setFileName(path);
+	if (!m_file.open(QIODevice::ReadOnly))
+	{
+		return false;
+	}
+	m_size = m_file.size();
+	m_data = m_file.map(0, m_size);
+	if (!m_data || m_size < bundleHeaderSize)
+	{
+		clear();
+		return false;
+	}
+	const QByteArray buffer = QByteArray::fromRawData(reinterpret_cast<const char*>(m_data), m_size);
+	QDataStream stream(buffer);
+	stream.setVersion(QDataStream::Qt_4_8);
+	//read header
+	quint32 magic, version, byteOrder;
+	qint64 indexOffset;
+	stream >> magic >> version >> byteOrder >> indexOffset;
+	//pixels of the other byte order would show up with swapped channels
+	if (magic != bundleMagic || version != bundleVersion || byteOrder != bundleByteOrder
+		|| indexOffset < bundleHeaderSize || indexOffset > m_size)
+	{
+		clear();
+		return false;
+	}
+	//read index
+	stream.device()->seek(indexOffset);
+	quint32 timestamp, imageCount;
+	qint32 frameBaseIndex;
+	stream >> timestamp >> m_frameSuffix >> frameBaseIndex;
+	stream >> m_frameCounts >> m_bounds;
+	stream >> imageCount;
+	if (stream.status() != QDataStream::Ok || timestamp < svgTimestamp)
+	{
+		clear();
+		return false;
+	}
+	m_frameBaseIndex = frameBaseIndex;
+	for (quint32 i = 0; i < imageCount; ++i)
+	{
+		QString key;
+		qint32 width, height;
+		ImageEntry entry;
+		stream >> key >> width >> height >> entry.offset;
+		//do not trust the index to point into the pixel data
+		if (stream.status() != QDataStream::Ok || width <= 0 || height <= 0
+			|| entry.offset < bundleHeaderSize || entry.offset % 4 != 0
+			|| entry.offset + qint64(width) * height * 4 > indexOffset)
+		{
+			clear();
+			return false;
+		}
+		entry.width = width;
+		entry.height = height;
+		m_images.insert(key, entry);
+	}
+	return true;
+}
+
+void KGRInternal::ThemeBundle::clear()
+{
+	if (m_data)
+	{
+		m_file.unmap(m_data);
+		m_data = 0;
+	}
+	m_file.close();
+	m_size = 0;
+	m_frameSuffix.clear();
+	m_frameBaseIndex = 0;
+	m_frameCounts.clear();
+	m_bounds.clear();
+	m_images.clear();
+}
+
+bool KGRInternal::ThemeBundle::isValid() const
+{
+	return m_data != 0;
+}
+
+bool KGRInternal::ThemeBundle::findFrameCount(const QString& key, const QString& frameSuffix, int frameBaseIndex, int* count) const
+{
+	if (frameSuffix != m_frameSuffix || frameBaseIndex != m_frameBaseIndex)
+	{
+		return false;
+	}
+	QHash<QString, int>::const_iterator it = m_frameCounts.constFind(key);
+	if (it == m_frameCounts.constEnd())
+	{
+		return false;
+	}
+	*count = it.value();
+	return true;
+}
+
+bool KGRInternal::ThemeBundle::findBounds(const QString& elementKey, QRectF* bounds) const
+{
+	QHash<QString, QRectF>::const_iterator it = m_bounds.constFind(elementKey);
+	if (it == m_bounds.constEnd())
+	{
+		return false;
+	}
+	*bounds = it.value();
+	return true;
+}
+
+bool KGRInternal::ThemeBundle::findImage(const QString& cacheKey, QImage* image) const
+{
+	QHash<QString, ImageEntry>::const_iterator it = m_images.constFind(cacheKey);
+	if (it == m_images.constEnd())
+	{
+		return false;
+	}
+	const ImageEntry& entry = it.value();
+	*image = QImage(static_cast<const uchar*>(m_data + entry.offset), entry.width, entry.height, entry.width * 4, QImage::Format_ARGB32_Premultiplied);
+	return true;
+}
@@ -0,0 +1,97 @@
+/***************************************************************************
+ *   Copyright 2014 KDE Games Team <kde-games-devel@kde.org>               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License          *
+ *   version 2 as published by the Free Software Foundation                *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef LIBKDEGAMES_KGAMERENDERERBUNDLE_P_H
+#define LIBKDEGAMES_KGAMERENDERERBUNDLE_P_H
+
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QRectF>
+#include <QtGui/QImage>
+
+namespace KGRInternal
+{
+	//The contents of a theme bundle, as collected by the kgrbundle tool.
+	struct BundleData
+	{
+		BundleData() : svgTimestamp(0), frameBaseIndex(0) {}
+		uint svgTimestamp;
+		QString frameSuffix;
+		int frameBaseIndex;
+		QHash<QString, int> frameCounts;   //sprite key -> frame count
+		QHash<QString, QRectF> bounds;     //element key -> bounds
+		QHash<QString, QImage> images;     //cache key -> rendered element
+	};
+
+	//A theme bundle is an optional file next to the SVG file of a theme. It
+	//contains the frame counts, element bounds and pre-rendered sprites which
+	//KGameRenderer would otherwise have to get from the SVG file. The pixel
+	//data is stored uncompressed, so that the file can be memory-mapped and
+	//sprites can be read without any decoding. Therefore a bundle is only
+	//loaded on machines with the byte order of the one that wrote it.
+	//
+	//File layout (all numbers in QDataStream big-endian encoding, except for
+	//the pixel data):
+	//  header: magic, format version, byte order, offset of index
+	//  pixel data of all images (ARGB32_Premultiplied, i.e. native-endian
+	//  32-bit pixels, 4-byte aligned)
+	//  index: svg timestamp, frame suffix, frame base index, frame counts,
+	//         bounds, and (cache key, width, height, offset) for each image
+	class ThemeBundle
+	{
+		public:
+			ThemeBundle();
+			~ThemeBundle();
+
+			//Returns the path of the bundle belonging to the given SVG file,
+			//e.g. "/foo/bar.svgz" -> "/foo/bar.kgrbundle".
+			static QString pathForGraphics(const QString& graphicsPath);
+			static bool write(const QString& path, const BundleData& data);
+
+			//Maps the bundle at the given path. Bundles older than the given
+			//timestamp of the SVG file are refused.
+			bool load(const QString& path, uint svgTimestamp);
+			void clear();
+			bool isValid() const;
+
+			//The frame counts in the bundle are only valid if the renderer
+			//uses the same frame suffix and base index as the bundle.
+			bool findFrameCount(const QString& key, const QString& frameSuffix, int frameBaseIndex, int* count) const;
+			bool findBounds(const QString& elementKey, QRectF* bounds) const;
+			//The returned image references the mapped file, so it must not be
+			//used after clear() or load() have been called.
+			bool findImage(const QString& cacheKey, QImage* image) const;
+		private:
+			struct ImageEntry
+			{
+				int width, height;
+				qint64 offset;
+			};
+
+			QFile m_file;
+			uchar* m_data;
+			qint64 m_size;
+			QString m_frameSuffix;
+			int m_frameBaseIndex;
+			QHash<QString, int> m_frameCounts;
+			QHash<QString, QRectF> m_bounds;
+			QHash<QString, ImageEntry> m_images;
+	};
+}
+
+#endif // LIBKDEGAMES_KGAMERENDERERBUNDLE_P_H
@@ -40,6 +40,7 @@ KGameRendererClient::KGameRendererClient(KGameRenderer* renderer, const QString&
 KGameRendererClient::~KGameRendererClient()
 {
 	d->m_renderer->d->m_clients.remove(this);
+	d->m_renderer->d->m_stagedPixmaps.remove(this);
 	delete d;
 }
 
@@ -44,8 +44,6 @@
 
 #define KGAME_LOAD_COOKIE 4210
 
-Q_LOGGING_CATEGORY(GAMES_PRIVATE_KGAME, "games.private.kgame")
-
 // try to place as much as possible here
 // many things are *not* possible here as KGame has to use some inline function
 class KGamePrivate
@@ -902,6 +900,13 @@ void KGame::networkTransmission(QDataStream &stream, int msgid, quint32 receiver
      qint16 v;
      qint32 c;
      stream >> v >> c;
+     if (!stream.atEnd())
+     {
+       // older masters don't announce any capabilities
+       qint8 capabilities;
+       stream >> capabilities;
+       setPeerCapabilities(sender, capabilities);
+     }
      qCDebug(GAMES_PRIVATE_KGAME) << " ===================> (Client) " << ": Got IdSetupGame ==================";
      qCDebug(GAMES_PRIVATE_KGAME) << "our game id is" << gameId() << "Lib version=" << v << "App Cookie=" << c;
      // Verify identity of the network partners
@@ -1081,6 +1086,13 @@ void KGame::setupGameContinue(QDataStream& stream, quint32 sender)
       qCDebug(GAMES_PRIVATE_KGAME) << "newplayerlist appended" << player->id();
     }
   }
+  if (!stream.atEnd())
+  {
+    // older clients don't announce any capabilities
+    qint8 capabilities;
+    stream >> capabilities;
+    setPeerCapabilities(sender, capabilities);
+  }
 
   newPlayersJoin(playerList(),&newPlayerList,inactivateIds);
 
@@ -1249,6 +1261,7 @@ void KGame::setupGame(quint32 sender)
     qCWarning(GAMES_PRIVATE_KGAME) << "KGame::setupGame(): Player list is not empty! or cnt!=0=" <<cnt;
     abort();
   }
+  streamS << (qint8)KGameMessage::CapCompression;
 
   sendSystemMessage(streamS,KGameMessage::IdSetupGameContinue,sender);
 }
@@ -1422,7 +1435,7 @@ void KGame::negotiateNetworkGame(quint32 clientID)
  // send to the newly connected client *only*
  qint16 v=KGameMessage::version();
  qint32 c=cookie();
- streamGS << v << c;
+ streamGS << v << c << (qint8)KGameMessage::CapCompression;
  sendSystemMessage(streamGS, KGameMessage::IdSetupGame, clientID);
 }
 
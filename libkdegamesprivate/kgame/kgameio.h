@@ -346,9 +346,8 @@ private:
  * 
  *  The KGameProcessIO class. It is used to create a computer player
  *  via a separate process and communicate transparetly with it.
- *  Its counterpart is the @ref KGameProcess class which needs
- *  to be used by the computer player. See its documentation
- *  for the definition of the computer player.
+ *  The process talks to it through a @ref KMessageFilePipe on its
+ *  stdin and stdout.
  */
 class KDEGAMESPRIVATE_EXPORT KGameProcessIO : public KGameIO
 {
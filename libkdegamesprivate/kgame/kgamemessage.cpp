@@ -118,6 +118,8 @@ QString KGameMessage::messageId2Text(int msgid)
 		return i18n("Client game connected");
 	case KGameMessage::IdGameSetupDone:
 		return i18n("Game setup done");
+	case KGameMessage::IdCompressed:
+		return i18n("Compressed Message");
 	case KGameMessage::IdSyncRandom:
 		return i18n("Synchronize Random");
 	case KGameMessage::IdDisconnect:
@@ -145,6 +145,7 @@ class KDEGAMESPRIVATE_EXPORT KGameMessage
     IdSyncRandom=5,        // new random seed set - sync games
     IdDisconnect=6,        // KGame object disconnects from game
     IdGameSetupDone=7,     // New game client is now operational
+    IdCompressed=8,        // a compressed message, see KGameNetwork::setCompressionThreshold
 
 // properties
     IdPlayerProperty=20,   // a player property changed
@@ -168,6 +169,14 @@ class KDEGAMESPRIVATE_EXPORT KGameMessage
 
     IdUser=256          // a user specified message
   };
+
+  /**
+   * Optional features of the network protocol. They are announced by the
+   * master in IdSetupGame and by the client in IdSetupGameContinue.
+   **/
+  enum Capabilities {
+    CapCompression=0x01     // can receive IdCompressed messages
+  };
 };
 
 #endif
@@ -30,6 +30,7 @@
 
 #include <qbuffer.h>
 //Added by qt3to4:
+#include <QHash>
 #include <QList>
 #include <QLoggingCategory>
 
@@ -42,6 +43,8 @@ public:
                 mMessageServer = 0;
                 mDisconnectId = 0;
 		mService = 0;
+                mCompressionThreshold = 4096;
+                mNetworkThreadEnabled = false;
         }
 
 public:
@@ -53,6 +56,10 @@ public:
 	QString mName;
 
         int mCookie;
+
+        int mCompressionThreshold;
+        QHash<quint32, int> mPeerCapabilities;  // gameId() -> KGameMessage::Capabilities
+        bool mNetworkThreadEnabled;
 };
 
 // ------------------- NETWORK GAME ------------------------
@@ -76,6 +83,10 @@ KGameNetwork::~KGameNetwork()
  qCDebug(GAMES_PRIVATE_KGAME) << "this=" << this;
 // Debug();
  delete d->mService;
+ // not our child if it runs in its network thread
+ if (d->mMessageServer && !d->mMessageServer->parent()) {
+   delete d->mMessageServer;
+ }
  delete d;
 }
 
@@ -98,6 +109,18 @@ quint32 KGameNetwork::gameId() const
 int KGameNetwork::cookie() const
 { return d->mCookie; }
 
+void KGameNetwork::setCompressionThreshold(int bytes)
+{ d->mCompressionThreshold = bytes; }
+
+int KGameNetwork::compressionThreshold() const
+{ return d->mCompressionThreshold; }
+
+void KGameNetwork::setPeerCapabilities(quint32 gameid, int capabilities)
+{
+  qCDebug(GAMES_PRIVATE_KGAME) << "game" << gameid << "has capabilities" << capabilities;
+  d->mPeerCapabilities.insert(gameid, capabilities);
+}
+
 bool KGameNetwork::isMaster() const
 { return (d->mMessageServer != 0); }
 
@@ -166,6 +189,12 @@ void KGameNetwork::tryPublish()
  if (!d->mService->isPublished()) d->mService->publishAsync();
 }
 
+void KGameNetwork::setNetworkThreadEnabled(bool enabled)
+{ d->mNetworkThreadEnabled = enabled; }
+
+bool KGameNetwork::isNetworkThreadEnabled() const
+{ return d->mNetworkThreadEnabled; }
+
 void KGameNetwork::tryStopPublishing()
 {
  if (d->mService) d->mService->stop();
@@ -187,6 +216,11 @@ bool KGameNetwork::offerConnections(quint16 port)
  }
 
  tryStopPublishing();
+ if (d->mNetworkThreadEnabled && !d->mMessageServer->isUsingNetworkThread()) {
+   // a server in another thread can't have a parent, so we delete it ourselves
+   d->mMessageServer->setParent(0);
+   d->mMessageServer->startNetworkThread();
+ }
  qCDebug(GAMES_PRIVATE_KGAME) << "before Server->initNetwork";
  if (!d->mMessageServer->initNetwork (port)) {
    qCCritical(GAMES_PRIVATE_KGAME) << "Unable to bind to port" << port << "!";
@@ -342,6 +376,7 @@ void KGameNetwork::slotResetConnection()
 {
   qCDebug(GAMES_PRIVATE_KGAME) << "Resseting client disconnect id";
   d->mDisconnectId = 0;
+  d->mPeerCapabilities.clear();
 }
 
 void KGameNetwork::electAdmin(quint32 clientID)
@@ -416,8 +451,28 @@ bool KGameNetwork::sendSystemMessage(const QByteArray& data, int msgid, quint32
  quint32 receiverClient = KGameMessage::rawGameId(receiver); // KGame::gameId()
  int receiverPlayer = KGameMessage::rawPlayerId(receiver); // KPlayer::id()
 
- KGameMessage::createHeader(stream, sender, receiver, msgid);
- stream.writeRawData(data.data(), data.size());
+ // Compress large messages for a single KGame (not for a player, as these
+ // are processed by all clients) if it can decompress them
+ QByteArray compressed;
+ if (receiver != 0 && !KGameMessage::isPlayer(receiver) &&
+     d->mCompressionThreshold >= 0 && data.size() >= d->mCompressionThreshold &&
+     (d->mPeerCapabilities.value(receiver) & KGameMessage::CapCompression))
+ {
+   compressed = qCompress(data);
+ }
+
+ if (!compressed.isEmpty() && compressed.size() + 2 < data.size())
+ {
+   // the original message id is stored in front of the compressed data
+   KGameMessage::createHeader(stream, sender, receiver, KGameMessage::IdCompressed);
+   stream << (qint16)msgid;
+   stream.writeRawData(compressed.data(), compressed.size());
+ }
+ else
+ {
+   KGameMessage::createHeader(stream, sender, receiver, msgid);
+   stream.writeRawData(data.data(), data.size());
+ }
 
  /*
  qCDebug(GAMES_PRIVATE_KGAME) << "transmitGameClientMessage msgid=" << msgid << "recv="
@@ -502,6 +557,22 @@ void KGameNetwork::receiveNetworkTransmission(const QByteArray& receiveBuffer, q
  }
  else
  {
+   QByteArray uncompressed;
+   QBuffer uncompressedBuffer(&uncompressed);
+   if (msgid==KGameMessage::IdCompressed)
+   {
+     qint16 id;
+     stream >> id;
+     msgid = id;
+     uncompressed = qUncompress(stream.device()->readAll());
+     if (uncompressed.isEmpty())
+     {
+       qCWarning(GAMES_PRIVATE_KGAME) << "Could not uncompress message with id" << msgid;
+       return;
+     }
+     uncompressedBuffer.open(QIODevice::ReadOnly);
+     stream.setDevice(&uncompressedBuffer);
+   }
    networkTransmission(stream, msgid, receiver, sender, clientID);
  }
 }
@@ -110,6 +110,20 @@ public:
      **/
     bool offerConnections (quint16 port);
 
+    /**
+     * Runs the KMessageServer of a MASTER in a thread of its own as soon as
+     * it offers connections, so that routing the messages of the other
+     * clients doesn't wait for this (GUI) thread. See
+     * KMessageServer::startNetworkThread. Disabled by default.
+     **/
+    void setNetworkThreadEnabled(bool enabled);
+
+    /**
+     * @return whether the KMessageServer runs in a thread of its own when
+     * offering connections. See setNetworkThreadEnabled
+     **/
+    bool isNetworkThreadEnabled() const;
+
     void setDiscoveryInfo(const QString& type, const QString& name=QString());
     
     /**
@@ -221,6 +235,21 @@ public:
      **/
     int cookie() const;
 
+    /**
+     * Messages for a single KGame which are at least @p bytes large are
+     * sent compressed, if that KGame announced during the game setup that
+     * it can receive compressed messages. This mainly speeds up the
+     * transfer of the game state to a newly connected client. A negative
+     * value disables compression. The default is 4096 bytes.
+     **/
+    void setCompressionThreshold(int bytes);
+
+    /**
+     * @return the minimum size of a compressed message. See
+     * setCompressionThreshold
+     **/
+    int compressionThreshold() const;
+
     /**
      * Send a network message msg with a given message ID msgid to all clients.
      * You want to use this to send a message to the clients.
@@ -382,6 +411,13 @@ protected:
      **/
     void setMaster();
 
+    /**
+     * @internal
+     * Stores the KGameMessage::Capabilities which the KGame with the id
+     * @p gameid announced during the game setup.
+     **/
+    void setPeerCapabilities(quint32 gameid, int capabilities);
+
 protected Q_SLOTS:
     /**
      * Called by KMessageClient::broadcastReceived() and will check if the
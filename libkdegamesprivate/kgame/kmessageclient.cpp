@@ -24,6 +24,8 @@
 #include <qbuffer.h>
 #include <QTimer>
 #include <QList>
+#include <QHash>
+#include <QLinkedList>
 #include <QDataStream>
 #include <QLoggingCategory>
 
@@ -43,7 +45,8 @@ public:
   }
 
   quint32 adminID;
-  QList <quint32> clientList;
+  QLinkedList <quint32> clientList;  // in the order of connecting
+  QHash <quint32, QLinkedList<quint32>::iterator> clientIndex;  // client ID -> entry in clientList
   KMessageIO *connection;
 
   bool isLocked;
@@ -115,7 +118,10 @@ quint32 KMessageClient::adminId () const
 
 QList <quint32> KMessageClient::clientList() const
 {
-  return d->clientList;
+  QList <quint32> list;
+  for (QLinkedList<quint32>::const_iterator iter (d->clientList.constBegin()); iter != d->clientList.constEnd(); ++iter)
+    list.append (*iter);
+  return list;
 }
 
 bool KMessageClient::isConnected () const
@@ -260,7 +266,13 @@ void KMessageClient::processMessage (const QByteArray &msg)
 
     case KMessageServer::ANS_CLIENT_LIST:
       {
-        in_stream >> d->clientList;
+        QList <quint32> list;
+        in_stream >> list;
+        d->clientList.clear();
+        d->clientIndex.clear();
+        for (QList<quint32>::const_iterator iter (list.constBegin()); iter != list.constEnd(); ++iter)
+          if (!d->clientIndex.contains (*iter))
+            d->clientIndex.insert (*iter, d->clientList.insert (d->clientList.end(), *iter));
       }
       break;
 
@@ -269,10 +281,12 @@ void KMessageClient::processMessage (const QByteArray &msg)
         quint32 id;
         in_stream >> id;
 
-        if (d->clientList.contains (id))
+        if (d->clientIndex.contains (id))
           qCWarning(GAMES_PRIVATE_KGAME) << ": Adding a client that already existed!";
         else
-          d->clientList.append (id);
+        {
+          d->clientIndex.insert (id, d->clientList.insert (d->clientList.end(), id));
+        }
 
         emit eventClientConnected (id);
       }
@@ -284,10 +298,14 @@ void KMessageClient::processMessage (const QByteArray &msg)
         qint8 broken;
         in_stream >> id >> broken;
 
-        if (!d->clientList.contains (id))
+        QHash<quint32, QLinkedList<quint32>::iterator>::iterator index = d->clientIndex.find (id);
+        if (index == d->clientIndex.end())
           qCWarning(GAMES_PRIVATE_KGAME) << ": Removing a client that doesn't exist!";
         else
-          d->clientList.removeAll (id);
+        {
+          d->clientList.erase (index.value());
+          d->clientIndex.erase (index);
+        }
 
         emit eventClientDisconnected (id, bool (broken));
       }
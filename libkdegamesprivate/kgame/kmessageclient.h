@@ -95,7 +95,8 @@ public:
   quint32 adminId() const;
 
   /**
-    @return The list of the IDs of all the message clients connected to the message server.
+    @return The list of the IDs of all the message clients connected to the message server,
+    in the order of connecting.
   */
   QList <quint32> clientList() const;
 
@@ -25,7 +25,76 @@
 #include <QTcpSocket>
 #include <kprocess.h>
 #include <QFile>
+#include <QFileDevice>
 #include <QDataStream>
+#include <QtEndian>
+#include <QTimer>
+#include <QSharedMemory>
+#include <QCoreApplication>
+#include <QMutex>
+
+#include <string.h>
+
+// defined here, so that the message code can be used without KGame
+Q_LOGGING_CATEGORY(GAMES_PRIVATE_KGAME, "games.private.kgame")
+
+// the messages queued by KMessageSocket::send are written to the socket
+// immediately when more than this many bytes are pending, messages of at
+// least this size aren't queued at all
+static const int maxPendingOutput = 16 * 1024;
+
+// time in ms a deleted KMessageSocket waits for the rest of its messages to
+// be sent before the connection is aborted
+static const int closeTimeout = 30 * 1000;
+
+// default for KMessageSocket::maxMessageSize, also the limit for messages
+// from a KMessageProcess
+static const quint32 defaultMaxMessageSize = 64 * 1024 * 1024;
+
+// Frames between KMessageProcess and its process consist of a header with a
+// cookie and the size of the whole frame, followed by the payload. Old helper
+// processes use native longs for both header fields (the legacy framing), the
+// current format uses big endian quint32s. KMessageFilePipe, the side of the
+// process, always uses the fixed-width header and starts with a frame with
+// processHelloCookie. KMessageProcess keeps sending legacy frames until it got
+// a frame with the fixed-width header, and both sides accept legacy frames
+// until then, so helpers built against the old framing keep working. Frames
+// with the fixed-width header have a 0x4242aeXX cookie, the receiver skips
+// those with a cookie that it doesn't know.
+static const int processHeaderSize = 8;
+static const int legacyHeaderSize = 2 * sizeof(long);
+static const quint32 processCookie = 0x4242aeae;
+static const quint32 processHelloCookie = 0x4242aeb1;
+
+// Messages between KMessageProcess and its process can also be passed through
+// a shared memory segment. The hello frame of the process carries a big endian
+// quint32 with feature flags. Only if it has processFeatureSharedMemory set,
+// KMessageProcess creates the segment and sends its QSharedMemory key in a
+// frame with processSharedMemoryCookie. The segment starts with a
+// SharedRingHeader, followed by two rings of SharedRingHeader::ringSize bytes:
+// the first one for messages to the process, the second one for messages from
+// it. If the process could attach to the segment, it answers with a frame with
+// processAttachedCookie. From then on, both sides may send a frame with
+// processDoorbellCookie and the size of a message (big endian quint32) as
+// payload, which means that the next message is in the ring of that direction.
+// The reader advances readPos of the ring after copying a message.
+static const quint32 processAttachedCookie = 0x4242aeaf;
+static const quint32 processDoorbellCookie = 0x4242aeb0;
+static const quint32 processSharedMemoryCookie = 0x4242aeb2;
+static const quint32 processFeatureSharedMemory = 0x1;
+
+struct SharedRingHeader
+{
+  quint32 ringSize;
+  QBasicAtomicInt readPos[2];
+};
+static const int sharedHeaderSize = 64;
+static const int sharedRingSize = 1024 * 1024;
+
+// only messages of at least this size are passed through the shared memory,
+// smaller ones are cheaper to send through the pipe directly
+static const int sharedMemoryThreshold = 1024;
+
 // ----------------------- KMessageIO -------------------------
 
 KMessageIO::KMessageIO (QObject *parent)
@@ -82,7 +151,22 @@ KMessageSocket::KMessageSocket (int socketFD, QObject *parent)
 
 KMessageSocket::~KMessageSocket ()
 {
-  delete mSocket;
+  // Deleting a connected socket would drop the messages that are still
+  // queued (e.g. the last ones before a disconnect). So write them, and let
+  // the socket close the connection on its own once everything is sent.
+  flush ();
+  mSocket->disconnect (this);
+  mSocket->setParent (0);
+  if (mSocket->state() != QAbstractSocket::ConnectedState || mSocket->bytesToWrite() == 0)
+  {
+    delete mSocket;
+    return;
+  }
+  connect (mSocket, SIGNAL (disconnected()), mSocket, SLOT (deleteLater()));
+  connect (mSocket, SIGNAL (error(QAbstractSocket::SocketError)), mSocket, SLOT (deleteLater()));
+  // don't wait forever for a peer that doesn't read anymore
+  QTimer::singleShot (closeTimeout, mSocket, SLOT (deleteLater()));
+  mSocket->disconnectFromHost ();
 }
 
 bool KMessageSocket::isConnected () const
@@ -92,9 +176,70 @@ bool KMessageSocket::isConnected () const
 
 void KMessageSocket::send (const QByteArray &msg)
 {
-  QDataStream str (mSocket);
-  str << quint8 ('M');  // magic number for begin of message
-  str.writeBytes (msg.data(), msg.size());  // writes the length (as quint32) and the data
+  // same format as QDataStream::writeBytes, but without streaming the data
+  // through another QDataStream: magic number, length (big endian) and data
+  uchar header[5];
+  header[0] = 'M';  // magic number for begin of message
+  qToBigEndian<quint32> (msg.size(), header + 1);
+
+  // the socket buffers its writes until the event loop runs anyway, so a
+  // large message goes there directly instead of being copied twice
+  if (msg.size() >= maxPendingOutput)
+  {
+    flush ();
+    mSocket->write ((const char*)header, sizeof (header));
+    mSocket->write (msg);
+    return;
+  }
+
+  mOutBuffer.append ((const char*)header, sizeof (header));
+  mOutBuffer.append (msg);
+
+  // collect the messages of this event loop iteration and write them together
+  if (mOutBuffer.size() >= maxPendingOutput)
+    flush ();
+  else if (!mFlushScheduled)
+  {
+    mFlushScheduled = true;
+    QTimer::singleShot (0, this, SLOT (flush()));
+  }
+}
+
+void KMessageSocket::flush ()
+{
+  mFlushScheduled = false;
+  if (mOutBuffer.isEmpty())
+    return;
+  mSocket->write (mOutBuffer);
+  mOutBuffer.clear();
+}
+
+void KMessageSocket::setNoDelay (bool on)
+{
+  mNoDelay = on;
+  applySocketOptions ();
+}
+
+bool KMessageSocket::noDelay () const
+{
+  return mNoDelay;
+}
+
+void KMessageSocket::applySocketOptions ()
+{
+  // has no effect before the connection is established, so this is called
+  // again from the connected() signal
+  mSocket->setSocketOption (QAbstractSocket::LowDelayOption, mNoDelay ? 1 : 0);
+}
+
+void KMessageSocket::setMaxMessageSize (quint32 size)
+{
+  mMaxMessageSize = size;
+}
+
+quint32 KMessageSocket::maxMessageSize () const
+{
+  return mMaxMessageSize;
 }
 
 void KMessageSocket::processNewData ()
@@ -103,51 +248,63 @@ void KMessageSocket::processNewData ()
     return;
   isRecursive = true;
 
-  QDataStream str (mSocket);
-  while (mSocket->bytesAvailable() > 0)
+  // more data may arrive while a received message is handled
+  do
   {
-    if (mAwaitingHeader)
+    // append everything available to the receive buffer
+    const qint64 available = mSocket->bytesAvailable();
+    if (available > 0)
     {
-      // Header = magic number + packet length = 5 bytes
-      if (mSocket->bytesAvailable() < 5)
-      {
-        isRecursive = false;
-        return;
-      }
+      const int oldSize = mInBuffer.size();
+      mInBuffer.resize (oldSize + int (available));
+      const qint64 count = mSocket->read (mInBuffer.data() + oldSize, available);
+      mInBuffer.resize (oldSize + int (qMax (count, qint64 (0))));
+    }
 
-      // Read the magic number first. If something unexpected is found,
-      // start over again, ignoring the data that was read up to then.
+    // Header = magic number + packet length (big endian) = 5 bytes
+    const int headerSize = 5;
+    while (mInBuffer.size() - mInOffset >= headerSize)
+    {
+      const char *data = mInBuffer.constData() + mInOffset;
+      const int size = mInBuffer.size() - mInOffset;
 
-      quint8 v;
-      str >> v;
-      if (v != 'M')
+      // If something unexpected is found, skip everything up to the next
+      // magic number and start over again.
+      if (data[0] != 'M')
       {
         qCWarning(GAMES_PRIVATE_KGAME) << ": Received unexpected data, magic number wrong!";
+        const char *next = (const char*)memchr (data, 'M', size);
+        mInOffset = next ? int (next - mInBuffer.constData()) : mInBuffer.size();
         continue;
       }
 
-      str >> mNextBlockLength;
-      mAwaitingHeader = false;
-    }
-    else
-    {
-      // Data not completely read => wait for more
-      if (mSocket->bytesAvailable() < (qint64) mNextBlockLength)
+      const quint32 length = qFromBigEndian<quint32> ((const uchar*)data + 1);
+      if (length > mMaxMessageSize)
       {
-        isRecursive = false;
-        return;
+        qCWarning(GAMES_PRIVATE_KGAME) << ": Received message header with invalid length" << length;
+        ++mInOffset;
+        continue;
       }
 
-      QByteArray msg (mNextBlockLength, 0);
-      str.readRawData (msg.data(), mNextBlockLength);
+      // Data not completely read => wait for more
+      if (quint32 (size - headerSize) < length)
+        break;
+
+      const QByteArray msg (data + headerSize, int (length));
+      mInOffset += headerSize + int (length);
 
       // send the received message
       emit received (msg);
-
-      // Waiting for the header of the next message
-      mAwaitingHeader = true;
     }
+
+    // drop the processed data
+    if (mInOffset >= mInBuffer.size())
+      mInBuffer.clear();
+    else if (mInOffset > 0)
+      mInBuffer.remove (0, mInOffset);
+    mInOffset = 0;
   }
+  while (mSocket->bytesAvailable() > 0);
 
   isRecursive = false;
 }
@@ -157,9 +314,15 @@ void KMessageSocket::initSocket ()
   connect (mSocket, SIGNAL (error(QAbstractSocket::SocketError)), this, SIGNAL (connectionBroken()));
   connect (mSocket, SIGNAL (disconnected()), this, SIGNAL (connectionBroken()));
   connect (mSocket, SIGNAL (readyRead()), this, SLOT (processNewData()));
-  mAwaitingHeader = true;
-  mNextBlockLength = 0;
+  connect (mSocket, SIGNAL (connected()), this, SLOT (applySocketOptions()));
+  // the socket has to follow us, e.g. into the network thread of a KMessageServer
+  mSocket->setParent (this);
+  mInOffset = 0;
+  mMaxMessageSize = defaultMaxMessageSize;
   isRecursive = false;
+  mFlushScheduled = false;
+  mNoDelay = true;
+  applySocketOptions ();
 }
 
 quint16 KMessageSocket::peerPort () const
@@ -174,6 +337,12 @@ QString KMessageSocket::peerName () const
 
 // ----------------------KMessageDirect -----------------------
 
+// The two ends of a KMessageDirect connection may live in different threads,
+// e.g. when the KMessageServer runs in its own network thread. This protects
+// the partner pointers. It is recursive, since a direct connected slot may
+// send an answer or delete the connection.
+static QMutex directMutex (QMutex::Recursive);
+
 KMessageDirect::KMessageDirect (KMessageDirect *partner, QObject *parent)
   : KMessageIO (parent), mPartner (0)
 {
@@ -181,6 +350,8 @@ KMessageDirect::KMessageDirect (KMessageDirect *partner, QObject *parent)
   if (!partner)
     return;
 
+  QMutexLocker locker (&directMutex);
+
   // Check if the other object is already connected
   if (partner && partner->mPartner)
   {
@@ -197,6 +368,7 @@ KMessageDirect::KMessageDirect (KMessageDirect *partner, QObject *parent)
 
 KMessageDirect::~KMessageDirect ()
 {
+  QMutexLocker locker (&directMutex);
   if (mPartner)
   {
     mPartner->mPartner = 0;
@@ -206,11 +378,13 @@ KMessageDirect::~KMessageDirect ()
 
 bool KMessageDirect::isConnected () const
 {
+  QMutexLocker locker (&directMutex);
   return mPartner != 0;
 }
 
 void KMessageDirect::send (const QByteArray &msg)
 {
+  QMutexLocker locker (&directMutex);
   if (mPartner)
     emit mPartner->received (msg);
   else
@@ -218,6 +392,330 @@ void KMessageDirect::send (const QByteArray &msg)
 }
 
 
+// ----------------------- KMessagePipe ---------------------------
+
+// The framing and the shared memory of the messages between KMessageProcess
+// (the parent side) and KMessageFilePipe (the child side)
+class KMessagePipe
+{
+  public:
+    enum Side { ParentSide = 0, ChildSide = 1 };
+
+    KMessagePipe(Side side);
+    ~KMessagePipe();
+
+    // Appends up to maxSize bytes from device to the receive buffer
+    qint64 read(QIODevice *device, qint64 maxSize);
+
+    // The number of bytes that are at least missing for the next frame
+    int missing() const;
+
+    // Takes the next complete message from the receive buffer. The frames of
+    // the shared memory handshake are handled here, their answers are written
+    // to device.
+    bool nextMessage(QIODevice *device, QByteArray *msg);
+
+    // Drops the frames taken by nextMessage from the receive buffer
+    void compact();
+
+    void send(QIODevice *device, const QByteArray &msg);
+
+    // Announces the fixed-width header and the shared memory to the parent
+    void sendHello(QIODevice *device);
+
+    bool usesSharedMemory() const { return mSharedMemoryAttached; }
+
+  private:
+    bool isLegacyHeader(const char *header) const;
+    bool nextFrame(quint32 *cookie, QByteArray *payload);
+    void writeFrame(QIODevice *device, quint32 cookie, const QByteArray &payload, bool fixedWidth);
+    bool createSharedMemory();
+    bool attachSharedMemory(const QString &key);
+    bool writeShared(const QByteArray &msg);
+    QByteArray readShared(quint32 size);
+
+    Side mSide;
+    QByteArray mReceiveBuffer;  // received data that isn't processed yet ...
+    int mReceiveOffset;         // ... starting at this position
+    bool mPeerUsesFixedWidth;
+
+    QSharedMemory *mSharedMemory;  // the segment with the rings
+    bool mSharedMemoryAttached;    // both sides use mSharedMemory
+    quint32 mSharedWritePos;       // bytes written to the ring of this side
+    quint32 mSharedReadPos;        // bytes read from the ring of the peer
+};
+
+KMessagePipe::KMessagePipe(Side side)
+{
+  mSide=side;
+  mReceiveOffset=0;
+  mPeerUsesFixedWidth=false;
+  mSharedMemory=0;
+  mSharedMemoryAttached=false;
+  mSharedWritePos=0;
+  mSharedReadPos=0;
+}
+
+KMessagePipe::~KMessagePipe()
+{
+  delete mSharedMemory;
+}
+
+qint64 KMessagePipe::read(QIODevice *device, qint64 maxSize)
+{
+  const int oldSize = mReceiveBuffer.size();
+  mReceiveBuffer.resize(oldSize + int(maxSize));
+  const qint64 count = device->read(mReceiveBuffer.data() + oldSize, maxSize);
+  mReceiveBuffer.resize(oldSize + int(qMax(count, qint64(0))));
+  return count;
+}
+
+bool KMessagePipe::isLegacyHeader(const char *header) const
+{
+  const long cookie = processCookie;
+  return !mPeerUsesFixedWidth && memcmp(header, &cookie, sizeof(long)) == 0;
+}
+
+int KMessagePipe::missing() const
+{
+  const int available = mReceiveBuffer.size() - mReceiveOffset;
+  const char *header = mReceiveBuffer.constData() + mReceiveOffset;
+  if (available < processHeaderSize)
+    return processHeaderSize - available;
+  if ((qFromBigEndian<quint32>((const uchar*)header) >> 8) == (processCookie >> 8))
+  {
+    const quint32 len = qFromBigEndian<quint32>((const uchar*)header + 4);
+    if (len >= quint32(processHeaderSize) && len <= defaultMaxMessageSize && len > quint32(available))
+      return int(len) - available;
+  }
+  else if (isLegacyHeader(header))
+  {
+    if (available < legacyHeaderSize)
+      return legacyHeaderSize - available;
+    long len;
+    memcpy(&len, header + sizeof(long), sizeof(long));
+    if (len >= legacyHeaderSize && len <= long(defaultMaxMessageSize) && len > available)
+      return int(len) - available;
+  }
+  return 1;
+}
+
+bool KMessagePipe::nextFrame(quint32 *cookie, QByteArray *payload)
+{
+  while (mReceiveBuffer.size() - mReceiveOffset >= processHeaderSize)
+  {
+    const int available = mReceiveBuffer.size() - mReceiveOffset;
+    const char *header = mReceiveBuffer.constData() + mReceiveOffset;
+    const quint32 frameCookie = qFromBigEndian<quint32>((const uchar*)header);
+    bool fixedWidth = true;
+    int headerSize = processHeaderSize;
+    quint32 len;
+    if ((frameCookie >> 8) == (processCookie >> 8))
+    {
+      len = qFromBigEndian<quint32>((const uchar*)header + 4);
+    }
+    else if (isLegacyHeader(header))
+    {
+      if (available < legacyHeaderSize)
+        return false;
+      long legacyLen;
+      memcpy(&legacyLen, header + sizeof(long), sizeof(long));
+      fixedWidth = false;
+      headerSize = legacyHeaderSize;
+      len = legacyLen < 0 || legacyLen > long(defaultMaxMessageSize) ? 0 : quint32(legacyLen);
+    }
+    else
+    {
+      // skip everything up to the next possible start of a frame, which is
+      // just the next byte as long as legacy frames are possible
+      qCDebug(GAMES_PRIVATE_KGAME) << ": Cookie error...transmission failure...serious problem...";
+      if (!mPeerUsesFixedWidth)
+      {
+        ++mReceiveOffset;
+        continue;
+      }
+      const char *next = (const char*)memchr(header + 1, processCookie >> 24, available - 1);
+      mReceiveOffset = next ? int(next - mReceiveBuffer.constData()) : mReceiveBuffer.size();
+      continue;
+    }
+    if (len < quint32(headerSize) || len > defaultMaxMessageSize)
+    {
+      qCDebug(GAMES_PRIVATE_KGAME) << ": Message size error";
+      ++mReceiveOffset;
+      continue;
+    }
+    if (len > quint32(available))
+      return false;
+
+    qCDebug(GAMES_PRIVATE_KGAME) << ": Got message with len" << len;
+    *cookie = fixedWidth ? frameCookie : processCookie;
+    *payload = QByteArray(header + headerSize, int(len) - headerSize);
+    mReceiveOffset += int(len);
+    if (fixedWidth)
+      mPeerUsesFixedWidth = true;
+    return true;
+  }
+  return false;
+}
+
+bool KMessagePipe::nextMessage(QIODevice *device, QByteArray *msg)
+{
+  quint32 cookie;
+  QByteArray payload;
+  while (nextFrame(&cookie, &payload))
+  {
+    if (cookie == processCookie)
+    {
+      *msg = payload;
+      return true;
+    }
+    else if (mSharedMemoryAttached && cookie == processDoorbellCookie && payload.size() == 4)
+    {
+      *msg = readShared(qFromBigEndian<quint32>((const uchar*)payload.constData()));
+      if (!msg->isNull())
+        return true;
+      qCDebug(GAMES_PRIVATE_KGAME) << ": Message size error";
+    }
+    else if (mSide == ParentSide && cookie == processHelloCookie && !mSharedMemory && payload.size() >= 4)
+    {
+      // the process can use shared memory, so create it now
+      if ((qFromBigEndian<quint32>((const uchar*)payload.constData()) & processFeatureSharedMemory) && createSharedMemory())
+        writeFrame(device, processSharedMemoryCookie, mSharedMemory->key().toUtf8(), true);
+    }
+    else if (mSide == ParentSide && cookie == processAttachedCookie && mSharedMemory)
+    {
+      qCDebug(GAMES_PRIVATE_KGAME) << ": Process uses the shared memory";
+      mSharedMemoryAttached = true;
+    }
+    else if (mSide == ChildSide && cookie == processSharedMemoryCookie && !mSharedMemory)
+    {
+      if (attachSharedMemory(QString::fromUtf8(payload)))
+      {
+        writeFrame(device, processAttachedCookie, QByteArray(), true);
+        mSharedMemoryAttached = true;
+      }
+    }
+  }
+  return false;
+}
+
+void KMessagePipe::send(QIODevice *device, const QByteArray &msg)
+{
+  if (mSharedMemoryAttached && msg.size()>=sharedMemoryThreshold && writeShared(msg))
+  {
+    // only tell the peer about the message in the shared memory
+    QByteArray size(4, Qt::Uninitialized);
+    qToBigEndian<quint32>(msg.size(), (uchar*)size.data());
+    writeFrame(device, processDoorbellCookie, size, true);
+    return;
+  }
+  writeFrame(device, processCookie, msg, mSide == ChildSide || mPeerUsesFixedWidth);
+}
+
+void KMessagePipe::sendHello(QIODevice *device)
+{
+  QByteArray features(4, Qt::Uninitialized);
+  qToBigEndian<quint32>(processFeatureSharedMemory, (uchar*)features.data());
+  writeFrame(device, processHelloCookie, features, true);
+}
+
+bool KMessagePipe::createSharedMemory()
+{
+  mSharedMemory=new QSharedMemory();
+  mSharedMemory->setKey(QString::fromLatin1("kgame-process-%1-%2")
+                        .arg(QCoreApplication::applicationPid())
+                        .arg(quintptr(this), 0, 16));
+  if (!mSharedMemory->create(sharedHeaderSize+2*sharedRingSize))
+  {
+    qCDebug(GAMES_PRIVATE_KGAME) << "@@@KMessageProcess::Cannot create shared memory:" << mSharedMemory->errorString();
+    delete mSharedMemory;
+    mSharedMemory=0;
+    return false;
+  }
+  SharedRingHeader *header=(SharedRingHeader*)mSharedMemory->data();
+  header->ringSize=sharedRingSize;
+  header->readPos[0].store(0);
+  header->readPos[1].store(0);
+  return true;
+}
+
+bool KMessagePipe::attachSharedMemory(const QString &key)
+{
+  mSharedMemory=new QSharedMemory(key);
+  if (!mSharedMemory->attach() || mSharedMemory->size()<sharedHeaderSize+2*sharedRingSize
+      || ((const SharedRingHeader*)mSharedMemory->constData())->ringSize!=quint32(sharedRingSize))
+  {
+    qCDebug(GAMES_PRIVATE_KGAME) << "@@@KMessageFilePipe::Cannot attach to shared memory:" << mSharedMemory->errorString();
+    delete mSharedMemory;
+    mSharedMemory=0;
+    return false;
+  }
+  return true;
+}
+
+bool KMessagePipe::writeShared(const QByteArray &msg)
+{
+  SharedRingHeader *header=(SharedRingHeader*)mSharedMemory->data();
+  const quint32 size=msg.size();
+  const quint32 used=mSharedWritePos-quint32(header->readPos[mSide].loadAcquire());
+  if (size>sharedRingSize-used)
+    return false;
+
+  char *ring=(char*)mSharedMemory->data()+sharedHeaderSize+mSide*sharedRingSize;
+  const quint32 start=mSharedWritePos%sharedRingSize;
+  const quint32 first=qMin(size, sharedRingSize-start);
+  memcpy(ring+start, msg.constData(), first);
+  memcpy(ring, msg.constData()+first, size-first);
+  mSharedWritePos+=size;
+  return true;
+}
+
+QByteArray KMessagePipe::readShared(quint32 size)
+{
+  SharedRingHeader *header=(SharedRingHeader*)mSharedMemory->data();
+  if (size>sharedRingSize)
+    return QByteArray();
+
+  const int peer=1-mSide;
+  const char *ring=(const char*)mSharedMemory->data()+sharedHeaderSize+peer*sharedRingSize;
+  const quint32 start=mSharedReadPos%sharedRingSize;
+  const quint32 first=qMin(size, sharedRingSize-start);
+  QByteArray msg(int(size), Qt::Uninitialized);
+  memcpy(msg.data(), ring+start, first);
+  memcpy(msg.data()+first, ring, size-first);
+  mSharedReadPos+=size;
+  header->readPos[peer].storeRelease(int(mSharedReadPos));
+  return msg;
+}
+
+void KMessagePipe::compact()
+{
+  // Drop the processed data, once per chunk
+  if (mReceiveOffset >= mReceiveBuffer.size())
+    mReceiveBuffer.clear();
+  else if (mReceiveOffset > 0)
+    mReceiveBuffer.remove(0, mReceiveOffset);
+  mReceiveOffset = 0;
+}
+
+void KMessagePipe::writeFrame(QIODevice *device, quint32 cookie, const QByteArray &payload, bool fixedWidth)
+{
+  if (fixedWidth)
+  {
+    uchar header[processHeaderSize];
+    qToBigEndian<quint32>(cookie, header);
+    qToBigEndian<quint32>(payload.size()+processHeaderSize, header+4);
+    device->write((const char*)header, processHeaderSize);
+  }
+  else
+  {
+    const long header[2] = { long(cookie), long(payload.size()+legacyHeaderSize) };
+    device->write((const char*)header, legacyHeaderSize);
+  }
+  // no need to add it to a queue -> qiodevice is buffered
+  device->write(payload);
+}
+
 // ----------------------- KMessageProcess ---------------------------
 
 KMessageProcess::~KMessageProcess()
@@ -228,8 +726,8 @@ KMessageProcess::~KMessageProcess()
     mProcess->kill();
     mProcess->deleteLater();
     mProcess=0;
-    // Maybe todo: delete mSendBuffer
   }
+  delete mPipe;
 }
 KMessageProcess::KMessageProcess(QObject *parent, const QString& file) : KMessageIO(parent)
 {
@@ -247,11 +745,10 @@ KMessageProcess::KMessageProcess(QObject *parent, const QString& file) : KMessag
   connect(mProcess, SIGNAL(readyReadStandardError()),  this, SLOT(slotReceivedStderr()));
   connect(mProcess, SIGNAL(finished(int,QProcess::ExitStatus)),
                         this, SLOT(slotProcessExited(int,QProcess::ExitStatus)));
+  mPipe=new KMessagePipe(KMessagePipe::ParentSide);
   mProcess->start();
-  mSendBuffer=0;
-  mReceiveCount=0;
-  mReceiveBuffer.resize(1024);
 }
+
 bool KMessageProcess::isConnected() const
 {
   qCDebug(GAMES_PRIVATE_KGAME) << "@@@KMessageProcess::Is conencted";
@@ -260,28 +757,22 @@ bool KMessageProcess::isConnected() const
   return (mProcess->state() == QProcess::Running);
 }
 
+bool KMessageProcess::usesSharedMemory() const
+{
+  return mPipe->usesSharedMemory();
+}
+
 // Send to process
 void KMessageProcess::send(const QByteArray &msg)
 {
   qCDebug(GAMES_PRIVATE_KGAME) << "@@@KMessageProcess:: SEND("<<msg.size()<<") to process";
-  unsigned int size=msg.size()+2*sizeof(long);
 
   if (mProcess == 0) {
     qCDebug(GAMES_PRIVATE_KGAME) << "@@@KMessageProcess:: cannot write to stdin, no process available";
     return;
   }
 
-  char *tmpbuffer=new char[size];
-  long *p1=(long *)tmpbuffer;
-  long *p2=p1+1;
-  qCDebug(GAMES_PRIVATE_KGAME)  << "p1="<<p1 << "p2="<< p2;
-  memcpy(tmpbuffer+2*sizeof(long),msg.data(),msg.size());
-  *p1=0x4242aeae;
-  *p2=size;
-
-  // no need to add it to a queue -> qiodevice is buffered
-  mProcess->write(tmpbuffer,size);
-  delete [] tmpbuffer;
+  mPipe->send(mProcess, msg);
 }
 
 void KMessageProcess::slotReceivedStderr()
@@ -307,52 +798,15 @@ void KMessageProcess::slotReceivedStderr()
 void KMessageProcess::slotReceivedStdout()
 {
   mProcess->setReadChannel(QProcess::StandardOutput);
-  QByteArray ba = mProcess->readAll();
-  qCDebug(GAMES_PRIVATE_KGAME) << "$$$$$$ " << ": Received" << ba.size() << "bytes over inter process communication";
+  const qint64 available = mProcess->bytesAvailable();
+  qCDebug(GAMES_PRIVATE_KGAME) << "$$$$$$ " << ": Received" << available << "bytes over inter process communication";
 
-  // Resize receive buffer
-  while (mReceiveCount+ba.size()>=mReceiveBuffer.size()) mReceiveBuffer.resize(mReceiveBuffer.size()+1024);
-  // was 08/2007: mReceiveBuffer += ba;
-  qCopy(ba.begin(), ba.begin()+ba.size(), mReceiveBuffer.begin()+mReceiveCount);
-  mReceiveCount += ba.size();
+  mPipe->read(mProcess, available);
 
-  // Possbile message
-  while (mReceiveCount>int(2*sizeof(long)))
-  {
-    long *p1=(long *)mReceiveBuffer.data();
-    long *p2=p1+1;
-    int len;
-    if (*p1!=0x4242aeae)
-    {
-      qCDebug(GAMES_PRIVATE_KGAME) << ": Cookie error...transmission failure...serious problem...";
-    }
-    len=(int)(*p2);
-    if (len<int(2*sizeof(long)))
-    {
-      qCDebug(GAMES_PRIVATE_KGAME) << ": Message size error";
-      break;
-    }
-    if (len<=mReceiveCount)
-    {
-      qCDebug(GAMES_PRIVATE_KGAME) << ": Got message with len" << len;
-
-      QByteArray msg ;
-      msg.resize(len);
-    //  msg.setRawData(mReceiveBuffer.data()+2*sizeof(long),len-2*sizeof(long));
-
-      qCopy(mReceiveBuffer.begin()+2*sizeof(long),mReceiveBuffer.begin()+len, msg.begin());
-//       msg.duplicate(mReceiveBuffer.data()+2*sizeof(long),len-2*sizeof(long));
-      emit received(msg);
-     // msg.resetRawData(mReceiveBuffer.data()+2*sizeof(long),len-2*sizeof(long));
-      // Shift buffer
-      if (len<mReceiveCount)
-      {
-        memmove(mReceiveBuffer.data(),mReceiveBuffer.data()+len,mReceiveCount-len);
-      }
-      mReceiveCount-=len;
-    }
-    else break;
-  }
+  QByteArray msg;
+  while (mPipe->nextMessage(mProcess, &msg))
+    emit received(msg);
+  mPipe->compact();
 }
 
 void KMessageProcess::slotProcessExited(int exitCode, QProcess::ExitStatus)
@@ -363,5 +817,73 @@ void KMessageProcess::slotProcessExited(int exitCode, QProcess::ExitStatus)
   mProcess=0;
 }
 
+// ----------------------- KMessageFilePipe ---------------------------
+
+KMessageFilePipe::KMessageFilePipe(QObject *parent, QIODevice *readDevice, QIODevice *writeDevice)
+  : KMessageIO(parent)
+{
+  mReadDevice=readDevice;
+  mWriteDevice=writeDevice;
+  mPipe=new KMessagePipe(KMessagePipe::ChildSide);
+  mConnected=true;
+
+  // Tell the parent process that it can use the fixed-width header
+  mPipe->sendHello(mWriteDevice);
+  flush();
+}
+
+KMessageFilePipe::~KMessageFilePipe()
+{
+  delete mPipe;
+}
+
+bool KMessageFilePipe::isConnected() const
+{
+  return mConnected && mReadDevice->isOpen() && mWriteDevice->isOpen();
+}
+
+void KMessageFilePipe::flush()
+{
+  QFileDevice *file = qobject_cast<QFileDevice*>(mWriteDevice);
+  if (file)
+    file->flush();
+}
+
+bool KMessageFilePipe::usesSharedMemory() const
+{
+  return mPipe->usesSharedMemory();
+}
+
+void KMessageFilePipe::send(const QByteArray &msg)
+{
+  mPipe->send(mWriteDevice, msg);
+  flush();
+}
+
+void KMessageFilePipe::exec()
+{
+  // A blocking read is ok, as long as it only waits for data that the parent
+  // process sends anyway
+  const qint64 maxSize = qMax(mReadDevice->bytesAvailable(), qint64(mPipe->missing()));
+  const qint64 count = mPipe->read(mReadDevice, maxSize);
+  if (count < 0 || (count == 0 && mReadDevice->isSequential()))
+  {
+    // nothing more to read from a pipe: the parent process closed it
+    if (mConnected)
+    {
+      mConnected = false;
+      emit connectionBroken();
+    }
+    return;
+  }
+
+  QByteArray msg;
+  while (mPipe->nextMessage(mWriteDevice, &msg))
+    emit received(msg);
+  mPipe->compact();
+  // the answers to the shared memory handshake
+  flush();
+}
+
 #include "kmessageio.moc"
 
@@ -40,6 +40,8 @@ Q_DECLARE_LOGGING_CATEGORY(GAMES_PRIVATE_KGAME)
 class QTcpSocket;
 class KProcess;
 class QFile;
+class QIODevice;
+class KMessagePipe;
 
 
 /**
@@ -229,7 +231,8 @@ public:
   explicit KMessageSocket (int socketFD, QObject *parent = 0);
 
   /**
-    Destructor, closes the socket.
+    Destructor, closes the connection. Messages queued by /e send() are still
+    written to the socket, which is closed after they have been sent.
   */
   ~KMessageSocket ();
 
@@ -266,14 +269,59 @@ public:
   */
   void send (const QByteArray &msg);
 
+  /**
+    Enables or disables the TCP_NODELAY option of the socket, i.e. whether
+    small packets are sent immediately instead of being delayed by Nagle's
+    algorithm. Messages are already coalesced by /e send(), so this is
+    enabled by default. The option is also applied when the connection
+    is only established later.
+  */
+  void setNoDelay (bool on);
+
+  /**
+    Returns whether the TCP_NODELAY option is requested for the socket.
+  */
+  bool noDelay () const;
+
+  /**
+    Sets the maximum size of a received message. A message header announcing
+    a larger message is treated as corrupt data: it is skipped and the
+    receiver searches for the next message header. This prevents a broken or
+    malicious peer from making us allocate huge buffers. The default is 64 MB.
+  */
+  void setMaxMessageSize (quint32 size);
+
+  /**
+    Returns the maximum size of a received message.
+  */
+  quint32 maxMessageSize () const;
+
+public Q_SLOTS:
+  /**
+    Writes all messages queued by /e send() to the socket now.
+
+    Messages sent during one event loop iteration are collected and written
+    to the socket together, when the event loop is entered again or when
+    more than a few kilobytes are pending. Larger messages are written to
+    the socket right away. Call this method to write them earlier.
+  */
+  void flush ();
+
 protected Q_SLOTS:
   virtual void processNewData ();
 
+private Q_SLOTS:
+  void applySocketOptions ();
+
 protected:
   void initSocket ();
   QTcpSocket *mSocket;
-  bool mAwaitingHeader;
-  quint32 mNextBlockLength;
+  QByteArray mInBuffer;  // received data that isn't processed yet ...
+  int mInOffset;         // ... starting at this position
+  quint32 mMaxMessageSize;
+  QByteArray mOutBuffer;
+  bool mFlushScheduled;
+  bool mNoDelay;
 
   bool isRecursive;  // workaround for "bug" in QSocket, Qt 2.2.3 or older
 };
@@ -353,6 +401,16 @@ protected:
 
 /**
  * \class KMessageProcess kmessageio.h <KGame/KMessageIO>
+ *
+ * This class implements the message communication with a child process
+ * through its stdin and stdout. The process uses a KMessageFilePipe on its
+ * side. Large messages are passed through a shared memory segment, which is
+ * created once the process announces that it can attach to it. See
+ * kmessageio.cpp for the protocol.
+ *
+ * The frame header used to consist of two native longs, a KMessageFilePipe
+ * uses a fixed-width header instead. Processes which still write the old
+ * header are detected by it and get their messages in the old format, too.
  */
 class KMessageProcess : public KMessageIO
 {
@@ -364,6 +422,12 @@ class KMessageProcess : public KMessageIO
     bool isConnected() const;
     void send (const QByteArray &msg);
 
+    /**
+      @return TRUE if the process has attached to the shared memory segment,
+      so that large messages are passed through it.
+    */
+    bool usesSharedMemory() const;
+
     /**
       @return FALSE as this is no network IO.
     */
@@ -387,9 +451,68 @@ class KMessageProcess : public KMessageIO
   private:
     QString mProcessName;
     KProcess *mProcess;
-    QByteArray* mSendBuffer;
-    QByteArray mReceiveBuffer;
-    int mReceiveCount;
+    KMessagePipe *mPipe;
+};
+
+/**
+ * \class KMessageFilePipe kmessageio.h <KGame/KMessageIO>
+ *
+ * This class is the counterpart of KMessageProcess in the child process, so
+ * a computer player started by KGameProcessIO uses it to talk to the game. It
+ * reads the messages of the parent process from @p readDevice and writes its
+ * own ones to @p writeDevice, usually QFile objects opened on stdin and stdout.
+ * Open them unbuffered, so that no message waits in a buffer:
+ *
+ * \code
+ * QFile input, output;
+ * input.open(fileno(stdin), QIODevice::ReadOnly | QIODevice::Unbuffered);
+ * output.open(fileno(stdout), QIODevice::WriteOnly | QIODevice::Unbuffered);
+ * KMessageFilePipe pipe(0, &input, &output);
+ * connect(&pipe, SIGNAL(received(QByteArray)), ...);
+ * while (pipe.isConnected())
+ *   pipe.exec();
+ * \endcode
+ */
+class KDEGAMESPRIVATE_EXPORT KMessageFilePipe : public KMessageIO
+{
+  Q_OBJECT
+
+  public:
+    KMessageFilePipe(QObject *parent, QIODevice *readDevice, QIODevice *writeDevice);
+    ~KMessageFilePipe();
+    bool isConnected() const;
+    void send (const QByteArray &msg);
+
+    /**
+      @return TRUE if this process has attached to the shared memory segment
+      of the parent process, so that large messages are passed through it.
+    */
+    bool usesSharedMemory() const;
+
+    /**
+      Reads what the parent process has sent and emits received() for every
+      complete message. On a blocking device like stdin, this waits until some
+      data arrives. Call it in a loop as long as isConnected() is true.
+    */
+    void exec();
+
+    /**
+      @return FALSE as this is no network IO.
+    */
+    bool isNetwork() const { return false; }
+
+  /**
+  * The runtime idendifcation
+  */
+  virtual int rtti() const {return 4;}
+
+  private:
+    void flush();
+
+    QIODevice *mReadDevice;
+    QIODevice *mWriteDevice;
+    KMessagePipe *mPipe;
+    bool mConnected;   // false once the read device has reached its end
 };
 
 #endif
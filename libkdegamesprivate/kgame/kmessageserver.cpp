@@ -22,8 +22,12 @@
 
 #include <qiodevice.h>
 #include <qbuffer.h>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QLinkedList>
 #include <QList>
 #include <QQueue>
+#include <QThread>
 #include <QTimer>
 #include <QDataStream>
 #include <QLoggingCategory>
@@ -57,12 +61,18 @@ void KMessageServerSocket::slotNewConnection ()
 class MessageBuffer
 {
   public:
+    MessageBuffer ()
+      : id (0) { }
     MessageBuffer (quint32 clientID, const QByteArray &messageData)
       : id (clientID), data (messageData) { }
-    ~MessageBuffer () {}
     quint32 id;
     QByteArray data;
 };
+Q_DECLARE_TYPEINFO(MessageBuffer, Q_MOVABLE_TYPE);
+
+// maximum time in msecs spent processing queued messages in one event loop
+// iteration
+static const int messageBatchTime = 20;
 
 // ---------------- KMessageServer's private class
 
@@ -70,12 +80,12 @@ class KMessageServerPrivate
 {
 public:
   KMessageServerPrivate()
-    : mMaxClients (-1), mGameId (1), mUniqueClientNumber (1), mAdminID (0), mServerSocket (0) {}
+    : mMaxClients (-1), mGameId (1), mUniqueClientNumber (1), mAdminID (0), mServerSocket (0), mThread (0),
+      mReceivedMessages (0), mReceivedBytes (0), mSentMessages (0), mSentBytes (0) {}
 
   ~KMessageServerPrivate()
   {
     qDeleteAll(mClientList);
-    qDeleteAll(mMessageQueue);
   }
 
   int mMaxClients;
@@ -86,10 +96,18 @@ public:
 
   KMessageServerSocket* mServerSocket;
 
-  QList<KMessageIO*> mClientList;
-  QQueue <MessageBuffer*> mMessageQueue;
+  QLinkedList<KMessageIO*> mClientList;  // in the order of connecting, for broadcasts
+  QHash<quint32, QLinkedList<KMessageIO*>::iterator> mClientIndex;  // client ID -> entry in mClientList
+  QQueue <MessageBuffer> mMessageQueue;
   QTimer mTimer;
   bool mIsRecursive;
+
+  QThread* mThread;  // the network thread, see startNetworkThread
+
+  quint64 mReceivedMessages;
+  quint64 mReceivedBytes;
+  quint64 mSentMessages;
+  quint64 mSentBytes;
 };
 
 
@@ -102,8 +120,9 @@ KMessageServer::KMessageServer (quint16 cookie,QObject* parent)
   d = new KMessageServerPrivate;
   d->mIsRecursive=false;
   d->mCookie=cookie;
+  d->mTimer.setSingleShot(true);
   connect (&(d->mTimer), SIGNAL (timeout()),
-           this, SLOT (processOneMessage()));
+           this, SLOT (processMessages()));
   qCDebug(GAMES_PRIVATE_KGAME) << "CREATE(KMessageServer="
 		<< this
 		<< ") cookie="
@@ -115,6 +134,7 @@ KMessageServer::KMessageServer (quint16 cookie,QObject* parent)
 KMessageServer::~KMessageServer()
 {
   qCDebug(GAMES_PRIVATE_KGAME) << "this=" << this;
+  stopNetworkThread();
   Debug();
   stopNetwork();
   deleteClients();
@@ -126,6 +146,9 @@ KMessageServer::~KMessageServer()
 
 bool KMessageServer::initNetwork (quint16 port)
 {
+  bool result = false;
+  if (callInNetworkThread ("initNetwork", Q_RETURN_ARG (bool, result), Q_ARG (quint16, port)))
+    return result;
   qCDebug(GAMES_PRIVATE_KGAME) ;
 
   if (d->mServerSocket)
@@ -155,6 +178,9 @@ bool KMessageServer::initNetwork (quint16 port)
 
 quint16 KMessageServer::serverPort () const
 {
+  quint16 result = 0;
+  if (callInNetworkThread ("serverPort", Q_RETURN_ARG (quint16, result)))
+    return result;
   if (d->mServerSocket)
     return d->mServerSocket->serverPort();
   else
@@ -163,6 +189,8 @@ quint16 KMessageServer::serverPort () const
 
 void KMessageServer::stopNetwork()
 {
+  if (callInNetworkThread ("stopNetwork"))
+    return;
   if (d->mServerSocket) 
   {
     delete d->mServerSocket;
@@ -172,6 +200,9 @@ void KMessageServer::stopNetwork()
 
 bool KMessageServer::isOfferingConnections() const
 {
+  bool result = false;
+  if (callInNetworkThread ("isOfferingConnections", Q_RETURN_ARG (bool, result)))
+    return result;
   return d->mServerSocket != 0;
 }
 
@@ -179,6 +210,14 @@ bool KMessageServer::isOfferingConnections() const
 
 void KMessageServer::addClient (KMessageIO* client)
 {
+  // A client without a parent lives in the thread of the server (see
+  // moveObjectsToThread), e.g. the server end of a local KMessageClient
+  // created here. Only this thread can hand it over.
+  if (isOtherThread() && !client->parent() && client->thread() == QThread::currentThread())
+    client->moveToThread (d->mThread);
+  if (callInNetworkThread ("addClient", Q_ARG (KMessageIO*, client)))
+    return;
+
   QByteArray msg;
 
   // maximum number of clients reached?
@@ -204,7 +243,7 @@ void KMessageServer::addClient (KMessageIO* client)
   broadcastMessage (msg);
 
   // add to our list
-  d->mClientList.push_back(client);
+  d->mClientIndex.insert(client->id(), d->mClientList.insert(d->mClientList.end(), client));
 
   // tell it its ID
   QDataStream (&msg, QIODevice::WriteOnly) << quint32 (ANS_CLIENT_ID) << client->id();
@@ -232,12 +271,17 @@ void KMessageServer::addClient (KMessageIO* client)
 
 void KMessageServer::removeClient (KMessageIO* client, bool broken)
 {
+  if (callInNetworkThread ("removeClient", Q_ARG (KMessageIO*, client), Q_ARG (bool, broken)))
+    return;
   quint32 clientID = client->id();
-  if (!d->mClientList.removeAll(client))
+  QHash<quint32, QLinkedList<KMessageIO*>::iterator>::iterator index = d->mClientIndex.find(clientID);
+  if (index == d->mClientIndex.end() || *index.value() != client)
   {
     qCCritical(GAMES_PRIVATE_KGAME) << ": Deleting client that wasn't added before!";
     return;
   }
+  d->mClientList.erase(index.value());
+  d->mClientIndex.erase(index);
 
   // tell everyone about the removed client
   QByteArray msg;
@@ -248,7 +292,7 @@ void KMessageServer::removeClient (KMessageIO* client, bool broken)
   if (clientID == adminID())
   {
     if (!d->mClientList.isEmpty())
-      setAdmin (d->mClientList.front()->id());
+      setAdmin (d->mClientList.first()->id());
     else
       setAdmin (0);
   }
@@ -256,8 +300,11 @@ void KMessageServer::removeClient (KMessageIO* client, bool broken)
 
 void KMessageServer::deleteClients()
 {
+  if (callInNetworkThread ("deleteClients"))
+    return;
   qDeleteAll(d->mClientList);
   d->mClientList.clear();
+  d->mClientIndex.clear();
   d->mAdminID = 0;
 }
 
@@ -277,49 +324,63 @@ void KMessageServer::removeBrokenClient ()
 
 void KMessageServer::setMaxClients(int c)
 {
+  if (callInNetworkThread ("setMaxClients", Q_ARG (int, c)))
+    return;
   d->mMaxClients = c;
 }
 
 int KMessageServer::maxClients() const
 {
+  int result = 0;
+  if (callInNetworkThread ("maxClients", Q_RETURN_ARG (int, result)))
+    return result;
   return d->mMaxClients;
 }
 
 int KMessageServer::clientCount() const
 {
+  int result = 0;
+  if (callInNetworkThread ("clientCount", Q_RETURN_ARG (int, result)))
+    return result;
   return d->mClientList.count();
 }
 
 QList <quint32> KMessageServer::clientIDs () const
 {
+  QList <quint32> result;
+  if (callInNetworkThread ("clientIDs", Q_RETURN_ARG (QList<quint32>, result)))
+    return result;
   QList <quint32> list;
-  for (QList<KMessageIO*>::iterator iter(d->mClientList.begin()); iter!=d->mClientList.end(); ++iter)
+  for (QLinkedList<KMessageIO*>::iterator iter(d->mClientList.begin()); iter!=d->mClientList.end(); ++iter)
     list.append ((*iter)->id());
   return list;
 }
 
 KMessageIO* KMessageServer::findClient (quint32 no) const
 {
+  KMessageIO *result = 0;
+  if (callInNetworkThread ("findClient", Q_RETURN_ARG (KMessageIO*, result), Q_ARG (quint32, no)))
+    return result;
   if (no == 0)
     no = d->mAdminID;
 
-  QList<KMessageIO*>::iterator iter = d->mClientList.begin();
-  while (iter!=d->mClientList.end())
-  {
-    if ((*iter)->id() == no)
-      return (*iter);
-    ++iter;
-  }
-  return 0;
+  QHash<quint32, QLinkedList<KMessageIO*>::iterator>::const_iterator index = d->mClientIndex.constFind(no);
+  return index != d->mClientIndex.constEnd() ? *index.value() : 0;
 }
 
 quint32 KMessageServer::adminID () const
 {
+  quint32 result = 0;
+  if (callInNetworkThread ("adminID", Q_RETURN_ARG (quint32, result)))
+    return result;
   return d->mAdminID;
 }
 
 void KMessageServer::setAdmin (quint32 adminID)
 {
+  if (callInNetworkThread ("setAdmin", Q_ARG (quint32, adminID)))
+    return;
+
   // Trying to set the client that is already admin => nothing to do
   if (adminID == d->mAdminID)
     return;
@@ -340,6 +401,125 @@ void KMessageServer::setAdmin (quint32 adminID)
 }
 
 
+//------------------------------------------- network thread
+
+bool KMessageServer::startNetworkThread()
+{
+  if (d->mThread)
+    return true;
+  if (parent())
+  {
+    qCWarning(GAMES_PRIVATE_KGAME) << ": A server with a parent cannot be moved to a network thread!";
+    return false;
+  }
+
+  d->mThread = new QThread;
+  d->mThread->setObjectName (QLatin1String ("KMessageServer"));
+  moveObjectsToThread (d->mThread);
+  d->mThread->start();
+  return true;
+}
+
+void KMessageServer::stopNetworkThread()
+{
+  if (!d->mThread)
+    return;
+  if (QThread::currentThread() == d->mThread)
+  {
+    qCCritical(GAMES_PRIVATE_KGAME) << ": The network thread cannot be stopped from itself!";
+    return;
+  }
+
+  QMetaObject::invokeMethod (this, "moveToOwnerThread", Qt::BlockingQueuedConnection,
+                             Q_ARG (QThread*, QThread::currentThread()));
+  d->mThread->quit();
+  d->mThread->wait();
+  delete d->mThread;
+  d->mThread = 0;
+}
+
+bool KMessageServer::isUsingNetworkThread() const
+{
+  return d->mThread != 0;
+}
+
+void KMessageServer::moveToOwnerThread (QThread *thread)
+{
+  moveObjectsToThread (thread);
+}
+
+bool KMessageServer::isOtherThread() const
+{
+  return d->mThread && QThread::currentThread() != d->mThread;
+}
+
+bool KMessageServer::callInNetworkThread (const char *method, QGenericReturnArgument ret,
+                                          QGenericArgument val0, QGenericArgument val1) const
+{
+  if (!isOtherThread())
+    return false;
+  QMetaObject::invokeMethod (const_cast<KMessageServer*> (this), method, Qt::BlockingQueuedConnection,
+                             ret, val0, val1);
+  return true;
+}
+
+bool KMessageServer::callInNetworkThread (const char *method, QGenericArgument val0, QGenericArgument val1) const
+{
+  return callInNetworkThread (method, QGenericReturnArgument(), val0, val1);
+}
+
+// must be called in the thread the server currently lives in
+void KMessageServer::moveObjectsToThread (QThread *thread)
+{
+  moveToThread (thread);
+  d->mTimer.moveToThread (thread);
+  if (d->mServerSocket)
+    d->mServerSocket->moveToThread (thread);
+  // the clients without a parent move along: the network clients and the
+  // server end of the KMessageDirect pair of a local KMessageClient (see
+  // KMessageClient::setServer (KMessageServer*)), whose other end stays with
+  // the KMessageClient. Clients with a parent belong to another object.
+  for (QLinkedList<KMessageIO*>::iterator iter (d->mClientList.begin()); iter!=d->mClientList.end(); ++iter)
+  {
+    if ((*iter)->thread() == QThread::currentThread() && !(*iter)->parent())
+      (*iter)->moveToThread (thread);
+  }
+}
+
+//------------------------------------------- statistics
+
+quint64 KMessageServer::receivedMessageCount() const
+{
+  quint64 result = 0;
+  if (callInNetworkThread ("receivedMessageCount", Q_RETURN_ARG (quint64, result)))
+    return result;
+  return d->mReceivedMessages;
+}
+
+quint64 KMessageServer::receivedByteCount() const
+{
+  quint64 result = 0;
+  if (callInNetworkThread ("receivedByteCount", Q_RETURN_ARG (quint64, result)))
+    return result;
+  return d->mReceivedBytes;
+}
+
+quint64 KMessageServer::sentMessageCount() const
+{
+  quint64 result = 0;
+  if (callInNetworkThread ("sentMessageCount", Q_RETURN_ARG (quint64, result)))
+    return result;
+  return d->mSentMessages;
+}
+
+quint64 KMessageServer::sentByteCount() const
+{
+  quint64 result = 0;
+  if (callInNetworkThread ("sentByteCount", Q_RETURN_ARG (quint64, result)))
+    return result;
+  return d->mSentBytes;
+}
+
 //------------------------------------------- ID stuff
 
 quint32 KMessageServer::uniqueClientNumber() const
@@ -351,15 +531,21 @@ quint32 KMessageServer::uniqueClientNumber() const
 
 void KMessageServer::broadcastMessage (const QByteArray &msg)
 {
-  for (QList<KMessageIO*>::iterator iter (d->mClientList.begin()); iter!=d->mClientList.end(); ++iter)
+  for (QLinkedList<KMessageIO*>::iterator iter (d->mClientList.begin()); iter!=d->mClientList.end(); ++iter)
     (*iter)->send (msg);
+  d->mSentMessages += d->mClientList.count();
+  d->mSentBytes += quint64 (d->mClientList.count()) * msg.size();
 }
 
 void KMessageServer::sendMessage (quint32 id, const QByteArray &msg)
 {
   KMessageIO *client = findClient (id);
   if (client)
+  {
     client->send (msg);
+    ++d->mSentMessages;
+    d->mSentBytes += msg.size();
+  }
 }
 
 void KMessageServer::sendMessage (const QList <quint32> &ids, const QByteArray &msg)
@@ -379,14 +565,48 @@ void KMessageServer::getReceivedMessage (const QByteArray &msg)
   //qCDebug(GAMES_PRIVATE_KGAME) << ": size=" << msg.size();
   quint32 clientID = client->id();
 
-  //QByteArray *ta=new QByteArray;
-  //ta->duplicate(msg);
-  //d->mMessageQueue.enqueue (new MessageBuffer (clientID, *ta));
-
-  
-  d->mMessageQueue.enqueue (new MessageBuffer (clientID, msg));
+  ++d->mReceivedMessages;
+  d->mReceivedBytes += msg.size();
+  d->mMessageQueue.enqueue (MessageBuffer (clientID, msg));
   if (!d->mTimer.isActive())
-    d->mTimer.start(0); // AB: should be , TRUE i guess
+    d->mTimer.start(0);
+}
+
+void KMessageServer::processMessages ()
+{
+  // called from an event loop started while processing a message, the outer
+  // call will go on with the queue
+  if (d->mIsRecursive)
+    return;
+
+  QElapsedTimer time;
+  time.start();
+  while (!d->mMessageQueue.isEmpty())
+  {
+    processOneMessage ();
+    if (time.elapsed() >= messageBatchTime)
+    {
+      if (!d->mMessageQueue.isEmpty())
+        d->mTimer.start(0);
+      break;
+    }
+  }
+}
+
+// Appends the unread rest of the message in in_buffer to the new header in
+// out_msg. The result is built once and then shared by all the receivers, so
+// the payload is copied only once, independent of the number of receivers.
+static void appendPayload (QByteArray &out_msg, QBuffer &in_buffer)
+{
+  const QByteArray &in_msg = in_buffer.data();
+  const int offset = int (in_buffer.pos());
+  const int length = in_msg.size() - offset;
+  if (length > 0)
+  {
+    out_msg.reserve (out_msg.size() + length);
+    out_msg.append (in_msg.constData() + offset, length);
+  }
+  in_buffer.seek (in_msg.size());
 }
 
 void KMessageServer::processOneMessage ()
@@ -403,10 +623,11 @@ void KMessageServer::processOneMessage ()
   }
   d->mIsRecursive = true;
 
-  MessageBuffer *msg_buf = d->mMessageQueue.head();
+  // copied, because the queue may grow while the message is processed
+  MessageBuffer msg_buf = d->mMessageQueue.head();
 
-  quint32 clientID = msg_buf->id;
-  QBuffer in_buffer (&msg_buf->data);
+  quint32 clientID = msg_buf.id;
+  QBuffer in_buffer (&msg_buf.data);
   in_buffer.open (QIODevice::ReadOnly);
   QDataStream in_stream (&in_buffer);
 
@@ -417,7 +638,6 @@ void KMessageServer::processOneMessage ()
 
   bool unknown = false;
 
-  QByteArray ttt=in_buffer.buffer();
   quint32 messageID;
   in_stream >> messageID;
   //qCDebug(GAMES_PRIVATE_KGAME) << ": got message with messageID=" << messageID;
@@ -425,10 +645,7 @@ void KMessageServer::processOneMessage ()
   {
     case REQ_BROADCAST:
       out_stream << quint32 (MSG_BROADCAST) << clientID;
-      // FIXME, compiler bug?
-      // this should be okay, since QBuffer is subclass of QIODevice! :
-      // out_buffer.write (in_buffer.readAll());
-      out_buffer.QIODevice::write (in_buffer.readAll());
+      appendPayload (out_msg, in_buffer);
       broadcastMessage (out_msg);
       break;
 
@@ -437,8 +654,7 @@ void KMessageServer::processOneMessage ()
         QList <quint32> clients;
         in_stream >> clients;
         out_stream << quint32 (MSG_FORWARD) << clientID << clients;
-        // see above!
-        out_buffer.QIODevice::write (in_buffer.readAll());
+        appendPayload (out_msg, in_buffer);
         sendMessage (clients, out_msg);
       }
       break;
@@ -502,7 +718,7 @@ void KMessageServer::processOneMessage ()
   if (!unknown && !in_buffer.atEnd())
     qCWarning(GAMES_PRIVATE_KGAME) << ": Extra data received for message ID" << messageID;
 
-  emit messageReceived (msg_buf->data, clientID, unknown);
+  emit messageReceived (msg_buf.data, clientID, unknown);
 
   if (unknown)
     qCWarning(GAMES_PRIVATE_KGAME) << ": received unknown message ID" << messageID;
@@ -24,6 +24,7 @@
 #include <QtCore/QString>
 #include "../libkdegamesprivate_export.h"
 
+class QThread;
 class KMessageIO;
 class KMessageServerPrivate;
 
@@ -226,7 +227,7 @@ public:
      * system pick a free port
      * @return true if it worked
     */
-    bool initNetwork (quint16 port = 0);
+    Q_INVOKABLE bool initNetwork (quint16 port = 0);
 
     /**
      * Returns the TCP/IP port number we are listening to for incoming connections.
@@ -234,20 +235,56 @@ public:
      * especially necessary if you used 0 as port number in initNetwork().
      * @return the port number
      **/
-    quint16 serverPort () const;
+    Q_INVOKABLE quint16 serverPort () const;
 
     /**
      * Stops listening for connections. The already running connections are
      * not affected.
      * To listen for connections again call initNetwork again.
      **/
-    void stopNetwork();
+    Q_INVOKABLE void stopNetwork();
 
     /**
      * Are we still offer offering server connections?
      * @return true, if we are still listening to connections requests
      **/
-    bool isOfferingConnections() const;
+    Q_INVOKABLE bool isOfferingConnections() const;
+
+//---------------------------------- network thread
+
+    /**
+     * Moves the server to a thread of its own. From then on, accepting
+     * connections, reading and decoding the messages of the clients and
+     * routing them to the other clients doesn't depend on the event loop of
+     * the calling thread any more. A local @ref KMessageClient connected with
+     * @ref KMessageClient::setServer (KMessageServer*) only gets the messages
+     * meant for it delivered in its own thread.
+     *
+     * While the network thread runs, only initNetwork, serverPort,
+     * stopNetwork, isOfferingConnections, addClient, removeClient,
+     * deleteClients, setMaxClients, maxClients, clientCount, clientIDs,
+     * findClient, adminID, setAdmin and the statistics methods may be called
+     * from other threads. They are executed in the network thread and wait
+     * for the result. The signals are emitted in the network thread, so
+     * messageReceived has to be connected with Qt::DirectConnection.
+     *
+     * The server must not have a parent, and it has to be deleted or
+     * stopNetworkThread has to be called in the thread which called this.
+     * @return true if the server runs in a network thread now
+     **/
+    bool startNetworkThread();
+
+    /**
+     * Moves the server back to the thread which called startNetworkThread and
+     * stops the network thread. Must be called from that thread.
+     **/
+    void stopNetworkThread();
+
+    /**
+     * @return true if the server runs in a network thread, see
+     * startNetworkThread
+     **/
+    bool isUsingNetworkThread() const;
 
 //---------------------------------- adding / removing clients
 
@@ -294,6 +331,12 @@ private Q_SLOTS:
      **/
     void removeBrokenClient ();
 
+    /**
+     * Moves the server and the objects it uses to @p thread. Called in the
+     * network thread by stopNetworkThread.
+     **/
+    void moveToOwnerThread (QThread *thread);
+
 public:
     /**
      * sets the maximum number of clients which can connect.
@@ -306,33 +349,34 @@ public:
      *
      * @param maxnumber the number of clients
      **/
-    void setMaxClients(int maxnumber);
+    Q_INVOKABLE void setMaxClients(int maxnumber);
 
     /**
      * returns the maximum number of clients
      *
      * @return the number of clients
      **/
-    int maxClients() const;
+    Q_INVOKABLE int maxClients() const;
 
     /**
      * returns the current number of connected clients.
      *
      * @return the number of clients
      **/
-    int clientCount() const;
+    Q_INVOKABLE int clientCount() const;
 
     /**
-     * returns a list of the unique IDs of all clients.
+     * returns a list of the unique IDs of all clients, in the order of
+     * connecting.
      **/
-    QList <quint32> clientIDs() const;
+    Q_INVOKABLE QList <quint32> clientIDs() const;
 
     /**
      * Find the @ref KMessageIO object to the given client number.
      * @param no the client number to look for, or 0 to look for the admin
      * @return address of the client, or 0 if no client with that number exists
      **/
-    KMessageIO *findClient (quint32 no) const;
+    Q_INVOKABLE KMessageIO *findClient (quint32 no) const;
 
     /**
      * Returns the clientID of the admin, if there is a admin, 0 otherwise.
@@ -340,14 +384,14 @@ public:
      * NOTE: Most often you don't need to know that id, since you can
      * use clientID 0 to specify the admin.
      **/
-    quint32 adminID() const;
+    Q_INVOKABLE quint32 adminID() const;
 
     /**
      * Sets the admin to a new client with the given ID.
      * The old admin (if existed) and the new admin will get the ANS_ADMIN message.
      * If you use 0 as new adminID, no client will be admin.
      **/
-    void setAdmin (quint32 adminID);
+    Q_INVOKABLE void setAdmin (quint32 adminID);
 
 
 //------------------------------ ID stuff
@@ -396,6 +440,29 @@ public:
      **/
     virtual void sendMessage (const QList <quint32> &ids, const QByteArray &msg);
 
+//---------------------------------- statistics
+
+    /**
+     * @return the number of messages received from the clients
+     **/
+    Q_INVOKABLE quint64 receivedMessageCount() const;
+
+    /**
+     * @return the total size of the messages received from the clients
+     **/
+    Q_INVOKABLE quint64 receivedByteCount() const;
+
+    /**
+     * @return the number of messages sent to the clients. A broadcast counts
+     * once for every client.
+     **/
+    Q_INVOKABLE quint64 sentMessageCount() const;
+
+    /**
+     * @return the total size of the messages sent to the clients
+     **/
+    Q_INVOKABLE quint64 sentByteCount() const;
+
 protected Q_SLOTS:
     /**
      * This slot receives all the messages from the @ref KMessageIO::received signals.
@@ -409,8 +476,6 @@ protected Q_SLOTS:
     virtual void getReceivedMessage (const QByteArray &msg);
 
     /**
-     * This slot is called whenever there are elements in the message queue. This queue
-     * is filled by @ref getReceivedMessage.
      * This slot takes one message out of the queue and analyzes processes it,
      * if it recognizes it. (See message types in the description of the class.)
      * After that, the signal @ref messageReceived is emitted. Connect to that signal if
@@ -418,6 +483,16 @@ protected Q_SLOTS:
      **/
     virtual void processOneMessage ();
 
+private Q_SLOTS:
+    /**
+     * This slot is called whenever there are elements in the message queue. This queue
+     * is filled by @ref getReceivedMessage.
+     * It calls @ref processOneMessage until the queue is empty. If that takes too
+     * long, the remaining messages are processed in the next event loop iteration,
+     * so that the server stays responsive.
+     **/
+    void processMessages ();
+
 //---------------------------- Signals
 
 Q_SIGNALS:
@@ -459,6 +534,19 @@ protected:
     quint32 uniqueClientNumber() const;
 
 private:
+    bool isOtherThread() const;
+    void moveObjectsToThread (QThread *thread);
+
+    /**
+     * Calls the invokable @p method in the network thread and waits for it,
+     * if we are in another thread (see startNetworkThread).
+     * @return true if the call was passed on, so the caller has to return
+     **/
+    bool callInNetworkThread (const char *method, QGenericReturnArgument ret,
+                              QGenericArgument val0 = QGenericArgument(), QGenericArgument val1 = QGenericArgument()) const;
+    bool callInNetworkThread (const char *method,
+                              QGenericArgument val0 = QGenericArgument(), QGenericArgument val1 = QGenericArgument()) const;
+
     KMessageServerPrivate* d;
 };
 
@@ -30,10 +30,17 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <QPaintEvent>
 #include <QPainter>
+#include <QPixmapCache>
 #include <QRegion>
 #include <QApplication>
+#include <QAtomicInt>
+#include <QHash>
+#include <QSet>
 #include <QTimer>
 #include <QTime>
+#include <QVector>
+
+#include <algorithm>
 
 /*
   TODO:
@@ -44,22 +51,347 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define DEBUG_DONT_MERGE_UPDATES 0
 #define DEBUG_CANVAS_PAINTS      0
 
+/*
+    KGameCanvasSpatialIndex
+*/
+
+/* A uniform grid which maps cells to the visible items that cover them. Items
+   report changes with markDirty(), and the grid is brought up to date lazily
+   before each query. Items that span very many cells (e.g. backgrounds) are kept
+   in a separate list which is part of every query. */
+class KGameCanvasSpatialIndex {
+public:
+  enum { CellSize = 128, MaxItemCells = 64 };
+
+  KGameCanvasSpatialIndex() {}
+
+  void markDirty(KGameCanvasItem *el) { m_dirty.insert(el); }
+  void remove(KGameCanvasItem *el);
+
+  /* Returns the items whose rect might intersect r, in stacking order (bottom
+     to top). The caller still has to check visibility and rects. */
+  QList<KGameCanvasItem*> query(const QRect& r, KGameCanvasItem *first, int count);
+
+private:
+  QHash<quint64, QList<KGameCanvasItem*> > m_cells;
+  QList<KGameCanvasItem*> m_large_items;
+  QSet<KGameCanvasItem*> m_dirty;
+
+  /* shared by all indices, because items can move between canvases */
+  static QAtomicInt s_stamp;
+
+  void flush();
+  void insertIntoCells(KGameCanvasItem *el);
+  void removeFromCells(KGameCanvasItem *el);
+
+  static int cellCoord(int v) { return v >= 0 ? v / CellSize : -((-v - 1) / CellSize) - 1; }
+  static quint64 cellKey(int cx, int cy) { return (quint64(quint32(cx)) << 32) | quint32(cy); }
+  static qint64 cellCount(const QRect& r) {
+    return qint64(cellCoord(r.right()) - cellCoord(r.left()) + 1)
+         * qint64(cellCoord(r.bottom()) - cellCoord(r.top()) + 1);
+  }
+  static bool stackKeyLessThan(const KGameCanvasItem *a, const KGameCanvasItem *b) {
+    return a->m_stack_key < b->m_stack_key;
+  }
+  static QList<KGameCanvasItem*> allItems(KGameCanvasItem *first) {
+    QList<KGameCanvasItem*> retv;
+    for(KGameCanvasItem *el = first; el; el = el->m_next)
+      retv.append(el);
+    return retv;
+  }
+};
+
+QAtomicInt KGameCanvasSpatialIndex::s_stamp;
+
+void KGameCanvasSpatialIndex::remove(KGameCanvasItem *el) {
+  m_dirty.remove(el);
+  removeFromCells(el);
+}
+
+void KGameCanvasSpatialIndex::insertIntoCells(KGameCanvasItem *el) {
+  const QRect r = el->rect();
+  if(!el->m_visible || r.isEmpty())
+    return;
+  el->m_index_rect = r;
+
+  if(cellCount(r) > MaxItemCells) {
+    m_large_items.append(el);
+    return;
+  }
+  for(int cx = cellCoord(r.left()); cx <= cellCoord(r.right()); cx++)
+    for(int cy = cellCoord(r.top()); cy <= cellCoord(r.bottom()); cy++)
+      m_cells[cellKey(cx, cy)].append(el);
+}
+
+void KGameCanvasSpatialIndex::removeFromCells(KGameCanvasItem *el) {
+  const QRect r = el->m_index_rect;
+  if(r.isNull())
+    return;
+  el->m_index_rect = QRect();
+
+  if(cellCount(r) > MaxItemCells) {
+    m_large_items.removeOne(el);
+    return;
+  }
+  for(int cx = cellCoord(r.left()); cx <= cellCoord(r.right()); cx++)
+    for(int cy = cellCoord(r.top()); cy <= cellCoord(r.bottom()); cy++) {
+      QHash<quint64, QList<KGameCanvasItem*> >::iterator it = m_cells.find(cellKey(cx, cy));
+      if(it == m_cells.end())
+        continue;
+      it.value().removeOne(el);
+      if(it.value().isEmpty())
+        m_cells.erase(it);
+    }
+}
+
+void KGameCanvasSpatialIndex::flush() {
+  QSet<KGameCanvasItem*>::const_iterator it = m_dirty.constBegin();
+  for(; it != m_dirty.constEnd(); ++it) {
+    removeFromCells(*it);
+    insertIntoCells(*it);
+  }
+  m_dirty.clear();
+}
+
+QList<KGameCanvasItem*> KGameCanvasSpatialIndex::query(const QRect& r,
+                                  KGameCanvasItem *first, int count) {
+  /* very large areas (e.g. full repaints) are faster without the grid */
+  if(r.isEmpty() || cellCount(r) > count)
+    return allItems(first);
+
+  flush();
+
+  /* the stamp is used to report every item once, even if it covers many cells */
+  const unsigned stamp = unsigned(s_stamp.fetchAndAddRelaxed(1)) + 1;
+  QList<KGameCanvasItem*> retv;
+  for(int i=0;i<m_large_items.size();i++) {
+    KGameCanvasItem *el = m_large_items[i];
+    el->m_index_stamp = stamp;
+    retv.append(el);
+  }
+  for(int cx = cellCoord(r.left()); cx <= cellCoord(r.right()); cx++)
+    for(int cy = cellCoord(r.top()); cy <= cellCoord(r.bottom()); cy++) {
+      QHash<quint64, QList<KGameCanvasItem*> >::const_iterator it = m_cells.constFind(cellKey(cx, cy));
+      if(it == m_cells.constEnd())
+        continue;
+      const QList<KGameCanvasItem*>& cell = it.value();
+      for(int i=0;i<cell.size();i++) {
+        KGameCanvasItem *el = cell[i];
+        if(el->m_index_stamp != stamp) {
+          el->m_index_stamp = stamp;
+          retv.append(el);
+        }
+      }
+    }
+
+  /* sorting many candidates is slower than picking them from the item list */
+  if(retv.size() > count / 8) {
+    retv.clear();
+    for(KGameCanvasItem *el = first; el; el = el->m_next)
+      if(el->m_index_stamp == stamp)
+        retv.append(el);
+  }
+  else
+    std::sort(retv.begin(), retv.end(), stackKeyLessThan);
+  return retv;
+}
+
+
 /*
     KGameCanvasAbstract
 */
-KGameCanvasAbstract::KGameCanvasAbstract() {
+KGameCanvasAbstract::KGameCanvasAbstract()
+: m_first_item(NULL)
+, m_last_item(NULL)
+, m_item_count(0)
+, m_first_animated(NULL)
+, m_last_animated(NULL)
+, m_items_valid(true)
+, m_index(new KGameCanvasSpatialIndex) {
 
 }
 
 KGameCanvasAbstract::~KGameCanvasAbstract() {
    //Note: this does not delete the items, be sure not to leak memory!
-   for(int i=0;i<m_items.size();i++)
-     m_items[i]->m_canvas = NULL;
+   for(KGameCanvasItem *el = m_first_item; el; el = el->m_next) {
+     el->m_canvas = NULL;
+     el->m_index_rect = QRect();
+   }
+   delete m_index;
+}
+
+/* stack keys of new items are StackKeyGap apart, starting in the middle of
+   the range so that there is room for lowering items as well */
+static const quint64 StackKeyGap = Q_UINT64_C(1) << 20;
+static const quint64 StackKeyBase = Q_UINT64_C(1) << 62;
+/* smallest gap left between the keys of renumbered items */
+static const quint64 StackKeyMinGap = Q_UINT64_C(1) << 10;
+
+void KGameCanvasAbstract::linkItem(KGameCanvasItem *el, KGameCanvasItem *after) {
+  KGameCanvasItem *before = after ? after->m_next : m_first_item;
+  el->m_prev = after;
+  el->m_next = before;
+  if(after)
+    after->m_next = el;
+  else
+    m_first_item = el;
+  if(before)
+    before->m_prev = el;
+  else
+    m_last_item = el;
+  m_item_count++;
+  m_items_valid = false;
+
+  /* pick a key between the neighbours, if there is no room left renumber the
+     items around el */
+  bool renumber = false;
+  if(after && before) {
+    if(before->m_stack_key - after->m_stack_key > 1)
+      el->m_stack_key = after->m_stack_key + (before->m_stack_key - after->m_stack_key) / 2;
+    else
+      renumber = true;
+  }
+  else if(after) {
+    if(after->m_stack_key <= ~Q_UINT64_C(0) - StackKeyGap)
+      el->m_stack_key = after->m_stack_key + StackKeyGap;
+    else
+      renumber = true;
+  }
+  else if(before) {
+    if(before->m_stack_key >= StackKeyGap)
+      el->m_stack_key = before->m_stack_key - StackKeyGap;
+    else
+      renumber = true;
+  }
+  else
+    el->m_stack_key = StackKeyBase;
+
+  if(renumber)
+    renumberItems(el);
+}
+
+void KGameCanvasAbstract::renumberItems(KGameCanvasItem *el) {
+  /* grow a window of items around el (doubling its size each time) until the
+     keys of its bounds leave enough room to space the items in it evenly, so
+     that repeated insertions at one place stay cheap. A NULL bound is the end
+     of the list */
+  KGameCanvasItem *lo = el->m_prev;
+  KGameCanvasItem *hi = el->m_next;
+  quint64 n = 1;
+  for(;;) {
+    quint64 lo_key = lo ? lo->m_stack_key : 0;
+    quint64 hi_key = hi ? hi->m_stack_key : ~Q_UINT64_C(0);
+    quint64 gap = (hi_key - lo_key) / (n + 1);
+    if(gap >= StackKeyMinGap || (!lo && !hi)) {
+      quint64 key = lo_key;
+      for(KGameCanvasItem *it = lo ? lo->m_next : m_first_item; it != hi; it = it->m_next) {
+        key += gap;
+        it->m_stack_key = key;
+      }
+      return;
+    }
+    for(quint64 i = n; i > 0 && (lo || hi); ) {
+      if(lo) {
+        lo = lo->m_prev;
+        n++;
+        i--;
+      }
+      if(hi && i > 0) {
+        hi = hi->m_next;
+        n++;
+        i--;
+      }
+    }
+  }
+}
+
+void KGameCanvasAbstract::unlinkItem(KGameCanvasItem *el) {
+  if(el->m_prev)
+    el->m_prev->m_next = el->m_next;
+  else
+    m_first_item = el->m_next;
+  if(el->m_next)
+    el->m_next->m_prev = el->m_prev;
+  else
+    m_last_item = el->m_prev;
+  el->m_prev = NULL;
+  el->m_next = NULL;
+  m_item_count--;
+  m_items_valid = false;
+}
+
+void KGameCanvasAbstract::linkAnimated(KGameCanvasItem *el) {
+  el->m_anim_prev = m_last_animated;
+  el->m_anim_next = NULL;
+  if(m_last_animated)
+    m_last_animated->m_anim_next = el;
+  else
+    m_first_animated = el;
+  m_last_animated = el;
+}
+
+void KGameCanvasAbstract::unlinkAnimated(KGameCanvasItem *el) {
+  if(el->m_anim_prev)
+    el->m_anim_prev->m_anim_next = el->m_anim_next;
+  else
+    m_first_animated = el->m_anim_next;
+  if(el->m_anim_next)
+    el->m_anim_next->m_anim_prev = el->m_anim_prev;
+  else
+    m_last_animated = el->m_anim_prev;
+  el->m_anim_prev = NULL;
+  el->m_anim_next = NULL;
+}
+
+QList<KGameCanvasItem*> KGameCanvasAbstract::animatedItems() const {
+  QList<KGameCanvasItem*> retv;
+  for(KGameCanvasItem *el = m_first_animated; el; el = el->m_anim_next)
+    retv.append(el);
+  return retv;
+}
+
+const QList<KGameCanvasItem*>* KGameCanvasAbstract::items() const {
+  if(!m_items_valid) {
+    m_items.clear();
+    for(KGameCanvasItem *el = m_first_item; el; el = el->m_next)
+      m_items.append(el);
+    m_items_valid = true;
+  }
+  return &m_items;
+}
+
+void KGameCanvasAbstract::invalidateCache() {
+}
+
+void KGameCanvasAbstract::paintItems(QPainter* p, const QRect& prect, const QRegion& preg) {
+  QList<KGameCanvasItem*> items = m_index->query(prect, m_first_item, m_item_count);
+  for(int i=0;i<items.size();i++) {
+    KGameCanvasItem *el = items.at(i);
+    if( el->m_visible && prect.intersects( el->rect() )
+        && preg.contains( el->rect() ) ) {
+      el->m_last_rect = el->rect();
+      el->paintInternal(p, prect, preg, QPoint(), 1.0 );
+    }
+  }
+}
+
+int KGameCanvasAbstract::updateChangedItems() {
+  int count = 0;
+  /* updating the changes should not change any item, but be safe */
+  while(!m_changed_items.isEmpty()) {
+    QList<KGameCanvasItem*> changed;
+    changed.swap(m_changed_items);
+    for(int i=0;i<changed.size();i++)
+      changed[i]->updateChanges();
+    count += changed.size();
+  }
+  return count;
 }
 
 KGameCanvasItem* KGameCanvasAbstract::itemAt(const QPoint &pt) const {
-  for(int i=m_items.size()-1;i>=0;i--) {
-    KGameCanvasItem *el = m_items[i];
+  QList<KGameCanvasItem*> candidates = m_index->query(QRect(pt, QSize(1,1)), m_first_item, m_item_count);
+  for(int i=candidates.size()-1;i>=0;i--) {
+    KGameCanvasItem *el = candidates[i];
     if(el->m_visible && el->rect().contains(pt))
       return el;
   }
@@ -69,8 +401,9 @@ KGameCanvasItem* KGameCanvasAbstract::itemAt(const QPoint &pt) const {
 QList<KGameCanvasItem*> KGameCanvasAbstract::itemsAt(const QPoint &pt) const {
   QList<KGameCanvasItem*> retv;
 
-  for(int i=m_items.size()-1;i>=0;i--) {
-    KGameCanvasItem *el = m_items[i];
+  QList<KGameCanvasItem*> candidates = m_index->query(QRect(pt, QSize(1,1)), m_first_item, m_item_count);
+  for(int i=candidates.size()-1;i>=0;i--) {
+    KGameCanvasItem *el = candidates[i];
     if(el->m_visible && el->rect().contains(pt))
       retv.append(el);
   }
@@ -84,28 +417,132 @@ QList<KGameCanvasItem*> KGameCanvasAbstract::itemsAt(const QPoint &pt) const {
 */
 class KGameCanvasWidgetPrivate {
 public:
+  /* by default, animations are advanced 60 times per second */
+  enum { DefaultFrameRate = 60 };
+  /* if nothing changed for IdleTicks ticks, the animation clock slows down
+     to IdleDelay msecs, until anything changes again */
+  enum { IdleTicks = 30, IdleDelay = 100 };
+
   QTimer m_anim_timer;
   QTime m_anim_time;
+  int m_anim_delay;
+  int m_idle_ticks;
   bool m_pending_update;
-  QRegion m_pending_update_reg;
+  QVector<QRect> m_pending_rects;
+
+  /* rendered pixmaps waiting for a new render size, see setDisplaySize */
+  enum { RenderSizeDelay = 150 };
+  QTimer m_render_size_timer;
+  QSet<KGameCanvasRenderedPixmap*> m_render_size_pending;
+  int m_render_scale;
+
+  /* statistics of the last update */
+  int m_stat_changed_items;
+  int m_stat_invalidated_rects;
+  int m_stat_painted_rects;
+  int m_stat_painted_area;
+
+  QRegion takeUpdateRegion(const QRect& clip);
 
 #if DEBUG_CANVAS_PAINTS
   bool debug_paints;
 #endif //DEBUG_CANVAS_PAINTS
 
   KGameCanvasWidgetPrivate()
-  : m_pending_update(false)
+  : m_anim_delay(1000 / DefaultFrameRate)
+  , m_idle_ticks(0)
+  , m_pending_update(false)
+  , m_render_scale(1)
+  , m_stat_changed_items(0)
+  , m_stat_invalidated_rects(0)
+  , m_stat_painted_rects(0)
+  , m_stat_painted_area(0)
 #if DEBUG_CANVAS_PAINTS
   , debug_paints(false)
 #endif //DEBUG_CANVAS_PAINTS
   {}
 };
 
+/* the invalidated rects are merged until there are at most MaxMergedRects,
+   and two rects are merged if the rect containing both is at most
+   MergeOverhead percent bigger than the two rects */
+enum { MaxMergedRects = 32, MergeOverhead = 25 };
+
+static inline qint64 rectArea(const QRect& r) {
+  return qint64(r.width()) * r.height();
+}
+
+/* building a QRegion out of many small rects is very slow, so the rects are
+   merged into a few bigger ones first */
+static QRegion mergeRects(const QVector<QRect>& pending, const QRect& clip) {
+  QVector<QRect> rects;
+  for(int i=0;i<pending.size();i++) {
+    QRect r = pending[i] & clip;
+    if(r.isEmpty())
+      continue;
+
+    int merge = -1;
+    bool cheap = false;
+    qint64 merge_growth = 0;
+    for(int j=0;j<rects.size();j++) {
+      qint64 growth = rectArea(rects[j] | r) - rectArea(rects[j]) - rectArea(r);
+      if(growth*100 <= (rectArea(rects[j]) + rectArea(r))*MergeOverhead) {
+        merge = j;
+        cheap = true;
+        break;
+      }
+      if(merge == -1 || growth < merge_growth) {
+        merge = j;
+        merge_growth = growth;
+      }
+    }
+
+    if(cheap || rects.size() >= MaxMergedRects)
+      rects[merge] |= r;
+    else
+      rects.append(r);
+  }
+
+  QRect bounds;
+  qint64 area = 0;
+  for(int i=0;i<rects.size();i++) {
+    bounds |= rects[i];
+    area += rectArea(rects[i]);
+  }
+
+  QRegion reg;
+  if(rectArea(bounds)*100 <= area*(100+MergeOverhead))
+    reg = bounds;
+  else
+    for(int i=0;i<rects.size();i++)
+      reg |= rects[i];
+  return reg;
+}
+
+QRegion KGameCanvasWidgetPrivate::takeUpdateRegion(const QRect& clip) {
+  QRegion reg = mergeRects(m_pending_rects, clip);
+
+  m_stat_invalidated_rects = m_pending_rects.size();
+  m_stat_painted_rects = reg.rectCount();
+  m_stat_painted_area = 0;
+  foreach(const QRect& r, reg.rects())
+    m_stat_painted_area += r.width() * r.height();
+
+  m_pending_rects.clear();
+  return reg;
+}
+
 KGameCanvasWidget::KGameCanvasWidget(QWidget* parent)
 : QWidget(parent)
 , priv(new KGameCanvasWidgetPrivate()) {
   priv->m_anim_time.start();
+  priv->m_anim_timer.setTimerType(Qt::PreciseTimer);
+  priv->m_anim_timer.setInterval(priv->m_anim_delay);
   connect(&priv->m_anim_timer, SIGNAL(timeout()), this, SLOT(processAnimations()));
+  priv->m_render_scale = devicePixelRatio();
+  priv->m_render_size_timer.setSingleShot(true);
+  priv->m_render_size_timer.setInterval(KGameCanvasWidgetPrivate::RenderSizeDelay);
+  connect(&priv->m_render_size_timer, SIGNAL(timeout()), this, SLOT(updateRenderSizes()));
 }
 
 KGameCanvasWidget::~KGameCanvasWidget() {
@@ -113,11 +550,19 @@ KGameCanvasWidget::~KGameCanvasWidget() {
 }
 
 void KGameCanvasWidget::ensureAnimating() {
-  if(!priv->m_anim_timer.isActive() )
-      priv->m_anim_timer.start();
+  if(!priv->m_anim_timer.isActive() ) {
+      priv->m_idle_ticks = 0;
+      priv->m_anim_timer.start(priv->m_anim_delay);
+  }
 }
 
 void KGameCanvasWidget::ensurePendingUpdate() {
+  /* something changed, bring the animation clock back to full speed */
+  if(priv->m_idle_ticks >= KGameCanvasWidgetPrivate::IdleTicks
+        && priv->m_anim_timer.isActive())
+    priv->m_anim_timer.setInterval(priv->m_anim_delay);
+  priv->m_idle_ticks = 0;
+
   if(priv->m_pending_update)
     return;
   priv->m_pending_update = true;
@@ -130,41 +575,83 @@ void KGameCanvasWidget::ensurePendingUpdate() {
 }
 
 void KGameCanvasWidget::updateChanges() {
-  for(int i=0;i<m_items.size();i++) {
-    KGameCanvasItem *el = m_items.at(i);
+  /* the changes may already have been painted by processAnimations */
+  if(!priv->m_pending_update)
+    return;
 
-    if(el->m_changed)
-      el->updateChanges();
-  }
+  priv->m_stat_changed_items = updateChangedItems();
   priv->m_pending_update = false;
 
+  QRegion reg = priv->takeUpdateRegion(rect());
+
 #if DEBUG_CANVAS_PAINTS
   repaint();
   priv->debug_paints = true;
-  repaint( priv->m_pending_update_reg );
+  repaint( reg );
   QApplication::syncX();
   priv->debug_paints = false;
   usleep(100000);
-  repaint( priv->m_pending_update_reg );
+  repaint( reg );
   QApplication::syncX();
   usleep(100000);
 #else //DEBUG_CANVAS_PAINTS
-  repaint( priv->m_pending_update_reg );
+  if(!reg.isEmpty())
+    repaint( reg );
 #endif //DEBUG_CANVAS_PAINTS
-
-  priv->m_pending_update_reg = QRegion();
 }
 
 void KGameCanvasWidget::invalidate(const QRect& r, bool /*translate*/) {
-  priv->m_pending_update_reg |= r;
+  if(!r.isEmpty())
+    priv->m_pending_rects.append(r);
   ensurePendingUpdate();
 }
 
 void KGameCanvasWidget::invalidate(const QRegion& r, bool /*translate*/) {
-  priv->m_pending_update_reg |= r;
+  foreach(const QRect& rr, r.rects())
+    priv->m_pending_rects.append(rr);
   ensurePendingUpdate();
 }
 
+qreal KGameCanvasWidget::renderScale() const {
+  return devicePixelRatio();
+}
+
+void KGameCanvasWidget::scheduleRenderSizeUpdate(KGameCanvasRenderedPixmap* item) {
+  priv->m_render_size_pending.insert(item);
+  item->m_pendingCanvas = this;
+  /* restarting the timer merges bursts of resizes */
+  priv->m_render_size_timer.start();
+}
+
+void KGameCanvasWidget::cancelRenderSizeUpdate(KGameCanvasRenderedPixmap* item) {
+  priv->m_render_size_pending.remove(item);
+}
+
+void KGameCanvasWidget::updateRenderSizes() {
+  QSet<KGameCanvasRenderedPixmap*> pending;
+  pending.swap(priv->m_render_size_pending);
+  foreach(KGameCanvasRenderedPixmap* item, pending) {
+    item->m_pendingCanvas = 0;
+    item->updateRenderSize();
+  }
+}
+
+int KGameCanvasWidget::lastUpdateChangedItems() const {
+  return priv->m_stat_changed_items;
+}
+
+int KGameCanvasWidget::lastUpdateInvalidatedRects() const {
+  return priv->m_stat_invalidated_rects;
+}
+
+int KGameCanvasWidget::lastUpdatePaintedRects() const {
+  return priv->m_stat_painted_rects;
+}
+
+int KGameCanvasWidget::lastUpdatePaintedArea() const {
+  return priv->m_stat_painted_area;
+}
+
 void KGameCanvasWidget::paintEvent(QPaintEvent *event) {
 #if DEBUG_CANVAS_PAINTS
   if(priv->debug_paints)
@@ -175,24 +662,33 @@ void KGameCanvasWidget::paintEvent(QPaintEvent *event) {
   }
 #endif //DEBUG_CANVAS_PAINTS
 
-  {QPainter p(this);
-  QRect evr = event->rect();
-  QRegion evreg = event->region();
-
-  for(int i=0;i<m_items.size();i++) {
-    KGameCanvasItem *el = m_items.at(i);
-    if( el->m_visible && evr.intersects( el->rect() )
-        && evreg.contains( el->rect() ) ) {
-      el->m_last_rect = el->rect();
-      el->paintInternal(&p, evr, evreg, QPoint(), 1.0 );
+  /* the widget has been moved to a screen with another pixel ratio */
+  if(devicePixelRatio() != priv->m_render_scale) {
+    priv->m_render_scale = devicePixelRatio();
+    QList<const QList<KGameCanvasItem*>*> lists;
+    lists.append(items());
+    while(!lists.isEmpty()) {
+      const QList<KGameCanvasItem*>* list = lists.takeLast();
+      for(int i=0;i<list->size();i++) {
+        KGameCanvasItem *el = list->at(i);
+        if(KGameCanvasRenderedPixmap* rendered = dynamic_cast<KGameCanvasRenderedPixmap*>(el)) {
+          if(rendered->m_displaySize.isValid())
+            scheduleRenderSizeUpdate(rendered);
+        }
+        else if(KGameCanvasGroup* group = dynamic_cast<KGameCanvasGroup*>(el))
+          lists.append(group->items());
+      }
     }
-  }}
+  }
+
+  {QPainter p(this);
+  paintItems(&p, event->rect(), event->region());}
 
   QApplication::syncX();
 }
 
 void KGameCanvasWidget::processAnimations() {
-  if(m_animated_items.empty() ) {
+  if(!m_first_animated) {
     priv->m_anim_timer.stop();
     return;
   }
@@ -200,20 +696,39 @@ void KGameCanvasWidget::processAnimations() {
   int tm = priv->m_anim_time.elapsed();
 
   // The list MUST be copied, because it could be modified calling advance.
-  // After all since it is implicitly shared the copy will not happen unless
-  // is it actually modified
-  QList<KGameCanvasItem*> ait = m_animated_items;
+  QList<KGameCanvasItem*> ait = animatedItems();
   for(int i=0;i<ait.size();i++) {
     KGameCanvasItem *el = ait[i];
     el->advance(tm);
   }
 
-  if(m_animated_items.empty() )
+  /* paint all the changes of this tick at once, instead of waiting for
+     another event loop iteration */
+  if(priv->m_pending_update)
+    updateChanges();
+  else if(++priv->m_idle_ticks == KGameCanvasWidgetPrivate::IdleTicks)
+    priv->m_anim_timer.setInterval(qMax(priv->m_anim_delay, int(KGameCanvasWidgetPrivate::IdleDelay)));
+
+  if(!m_first_animated)
     priv->m_anim_timer.stop();
 }
 
 void KGameCanvasWidget::setAnimationDelay(int d) {
-  priv->m_anim_timer.setInterval(d);
+  priv->m_anim_delay = qMax(d, 0);
+  priv->m_idle_ticks = 0;
+  priv->m_anim_timer.setInterval(priv->m_anim_delay);
+}
+
+int KGameCanvasWidget::animationDelay() const {
+  return priv->m_anim_delay;
+}
+
+void KGameCanvasWidget::setFrameRate(int fps) {
+  setAnimationDelay(fps > 0 ? 1000 / fps : 0);
+}
+
+int KGameCanvasWidget::frameRate() const {
+  return priv->m_anim_delay > 0 ? 1000 / priv->m_anim_delay : 0;
 }
 
 int KGameCanvasWidget::mSecs() {
@@ -228,6 +743,100 @@ QPoint KGameCanvasWidget::canvasPosition() const {
 	return QPoint(0, 0);
 }
 
+/*
+    KGameCanvasImage
+*/
+class KGameCanvasImagePrivate {
+public:
+  QImage m_image;
+  QColor m_background;
+  QVector<QRect> m_pending_rects;
+
+  KGameCanvasImagePrivate(const QSize& size, QImage::Format format)
+  : m_image(size, format)
+  , m_background(Qt::transparent) {}
+};
+
+KGameCanvasImage::KGameCanvasImage(const QSize& size, QImage::Format format)
+: priv(new KGameCanvasImagePrivate(size, format)) {
+  priv->m_pending_rects.append(QRect(QPoint(), size));
+}
+
+KGameCanvasImage::~KGameCanvasImage() {
+  delete priv;
+}
+
+void KGameCanvasImage::ensureAnimating() {
+}
+
+void KGameCanvasImage::ensurePendingUpdate() {
+}
+
+void KGameCanvasImage::invalidate(const QRect& r, bool /*translate*/) {
+  if(!r.isEmpty())
+    priv->m_pending_rects.append(r);
+}
+
+void KGameCanvasImage::invalidate(const QRegion& r, bool /*translate*/) {
+  foreach(const QRect& rr, r.rects())
+    priv->m_pending_rects.append(rr);
+}
+
+QSize KGameCanvasImage::size() const {
+  return priv->m_image.size();
+}
+
+void KGameCanvasImage::resize(const QSize& size) {
+  if(priv->m_image.size() == size)
+    return;
+  priv->m_image = QImage(size, priv->m_image.format());
+  priv->m_pending_rects.clear();
+  priv->m_pending_rects.append(QRect(QPoint(), size));
+}
+
+QColor KGameCanvasImage::backgroundColor() const {
+  return priv->m_background;
+}
+
+void KGameCanvasImage::setBackgroundColor(const QColor& color) {
+  if(priv->m_background == color)
+    return;
+  priv->m_background = color;
+  priv->m_pending_rects.append(priv->m_image.rect());
+}
+
+void KGameCanvasImage::advance(int msecs) {
+  // The list MUST be copied, because it could be modified calling advance.
+  QList<KGameCanvasItem*> ait = animatedItems();
+  for(int i=0;i<ait.size();i++)
+    ait[i]->advance(msecs);
+}
+
+const QImage& KGameCanvasImage::image() {
+  updateChangedItems();
+
+  QRegion reg = mergeRects(priv->m_pending_rects, priv->m_image.rect());
+  priv->m_pending_rects.clear();
+  if(reg.isEmpty())
+    return priv->m_image;
+
+  QPainter p(&priv->m_image);
+  p.setClipRegion(reg);
+  p.setCompositionMode(QPainter::CompositionMode_Source);
+  p.fillRect(reg.boundingRect(), priv->m_background);
+  p.setCompositionMode(QPainter::CompositionMode_SourceOver);
+  paintItems(&p, reg.boundingRect(), reg);
+  return priv->m_image;
+}
+
+KGameCanvasWidget* KGameCanvasImage::topLevelCanvas() {
+  return NULL;
+}
+
+QPoint KGameCanvasImage::canvasPosition() const {
+  return QPoint(0, 0);
+}
+
 /*
     KGameCanvasItem
 */
@@ -237,22 +846,42 @@ KGameCanvasItem::KGameCanvasItem(KGameCanvasAbstract* KGameCanvas)
 , m_opacity(255)
 , m_pos(0,0)
 , m_canvas(KGameCanvas)
-, m_changed(false) {
-  if(m_canvas) m_canvas->m_items.append(this);
+, m_changed(false)
+, m_prev(NULL)
+, m_next(NULL)
+, m_stack_key(0)
+, m_anim_prev(NULL)
+, m_anim_next(NULL)
+, m_index_stamp(0)
+, m_layer_dirty(true) {
+  if(m_canvas)
+    m_canvas->linkItem(this, m_canvas->m_last_item);
 }
 
 KGameCanvasItem::~KGameCanvasItem() {
   if(m_canvas) {
-    m_canvas->m_items.removeAll(this);
+    if(m_visible)
+      m_canvas->invalidateCache();
+    m_canvas->m_index->remove(this);
+    m_canvas->unlinkItem(this);
     if(m_animated)
-      m_canvas->m_animated_items.removeAll(this);
+      m_canvas->unlinkAnimated(this);
     if(m_visible)
       m_canvas->invalidate(m_last_rect, false);
+    if(m_changed)
+      m_canvas->m_changed_items.removeOne(this);
   }
 }
 
 void KGameCanvasItem::changed() {
+  if(!m_changed && m_canvas)
+    m_canvas->m_changed_items.append(this);
   m_changed = true;
+  m_layer_dirty = true;
+  if(m_canvas) {
+    m_canvas->invalidateCache();
+    m_canvas->m_index->markDirty(this);
+  }
 
   //even if m_changed was already true we cannot optimiza away this call, because maybe the
   //item has been reparented, etc. It is a very quick call anyway.
@@ -260,6 +889,12 @@ void KGameCanvasItem::changed() {
     m_canvas->ensurePendingUpdate();
 }
 
+void KGameCanvasItem::changedKeepLayer() {
+  bool layer_dirty = m_layer_dirty;
+  changed();
+  m_layer_dirty = layer_dirty;
+}
+
 void KGameCanvasItem::updateChanges() {
   if(!m_changed)
     return;
@@ -271,22 +906,6 @@ void KGameCanvasItem::updateChanges() {
   m_changed = false;
 }
 
-QPixmap *KGameCanvasItem::transparence_pixmap_cache = NULL;
-
-QPixmap* KGameCanvasItem::getTransparenceCache(const QSize &s) {
-  if(!transparence_pixmap_cache)
-    transparence_pixmap_cache = new QPixmap();
-  if(s.width()>transparence_pixmap_cache->width() ||
-    s.height()>transparence_pixmap_cache->height()) {
-
-    /* Strange that a pixmap with alpha should be created this way, i think a qt bug */
-    *transparence_pixmap_cache = QPixmap::fromImage( QImage(
-      s.expandedTo(transparence_pixmap_cache->size()), QImage::Format_ARGB32 ) );
-  }
-
-  return transparence_pixmap_cache;
-}
-
 void KGameCanvasItem::paintInternal(QPainter* pp, const QRect& /*prect*/,
                     const QRegion& /*preg*/, const QPoint& /*delta*/, double cumulative_opacity) {
   int opacity = int(cumulative_opacity*m_opacity + 0.5);
@@ -295,42 +914,42 @@ void KGameCanvasItem::paintInternal(QPainter* pp, const QRect& /*prect*/,
     return;
 
   if(opacity >= 255) {
+    /* the layer is only needed while the item is translucent */
+    m_layer = QPixmap();
     paint(pp);
     return;
   }
 
+  /* the painter may already be translucent (e.g. when rendering the canvas
+     into another device), so combine with its opacity */
+  qreal old_opacity = pp->opacity();
   if(!layered()) {
-    pp->setOpacity(opacity/255.0);
+    pp->setOpacity(old_opacity*opacity/255.0);
     paint(pp);
-    pp->setOpacity(1.0);
+    pp->setOpacity(old_opacity);
     return;
   }
 
   QRect mr = rect();
-  QPixmap* cache = getTransparenceCache(mr.size());
+  if(mr.isEmpty())
+    return;
 
-  {
-    QPainter p(cache);
+  /* the layer holds the opaque item, and is kept until the item changes, so
+     that changing the opacity (of the item or of its groups) is just a blit */
+  if(m_layer_dirty || m_layer.size() != mr.size()) {
+    if(m_layer.size() != mr.size())
+      m_layer = QPixmap(mr.size());
+    m_layer.fill(Qt::transparent);
 
-    /* clear */
-    p.setBrush(QColor(255,255,255,0));
-    p.setPen(Qt::NoPen);
-    p.setCompositionMode(QPainter::CompositionMode_Source);
-    p.drawRect(QRect(QPoint(),mr.size()));
-
-    /* paint on the item */
+    QPainter p(&m_layer);
     p.translate(-mr.topLeft());
     paint(&p);
-    p.translate(mr.topLeft());
-
-    /* make the opacity */
-    p.setBrush( QColor(255,255,255,255-opacity) );
-    p.setPen( Qt::NoPen );
-    p.setCompositionMode( QPainter::CompositionMode_DestinationOut );
-    p.drawRect( QRect(QPoint(),mr.size()) );
+    m_layer_dirty = false;
   }
 
-  pp->drawPixmap(mr.topLeft(), *cache, QRect(QPoint(),mr.size()) );
+  pp->setOpacity(old_opacity*opacity/255.0);
+  pp->drawPixmap(mr.topLeft(), m_layer);
+  pp->setOpacity(old_opacity);
 }
 
 void KGameCanvasItem::putInCanvas(KGameCanvasAbstract *c) {
@@ -338,19 +957,27 @@ void KGameCanvasItem::putInCanvas(KGameCanvasAbstract *c) {
       return;
 
   if(m_canvas) {
-    if(m_visible)
+    if(m_visible) {
+      m_canvas->invalidateCache();
       m_canvas->invalidate(m_last_rect, false); //invalidate the previously drawn rectangle
-    m_canvas->m_items.removeAll(this);
+    }
+    m_canvas->m_index->remove(this);
+    m_canvas->unlinkItem(this);
     if(m_animated)
-      m_canvas->m_animated_items.removeAll(this);
+      m_canvas->unlinkAnimated(this);
+    if(m_changed)
+      m_canvas->m_changed_items.removeOne(this);
   }
 
   m_canvas = c;
 
   if(m_canvas) {
-    m_canvas->m_items.append(this);
+    m_canvas->linkItem(this, m_canvas->m_last_item);
+    m_canvas->m_index->markDirty(this);
+    if(m_changed)
+      m_canvas->m_changed_items.append(this);
     if(m_animated) {
-      m_canvas->m_animated_items.append(this);
+      m_canvas->linkAnimated(this);
       m_canvas->ensureAnimating();
     }
     if(m_visible)
@@ -364,8 +991,11 @@ void KGameCanvasItem::setVisible(bool v) {
 
   m_visible = v;
   if(m_canvas) {
-    if(!v)
+    m_canvas->m_index->markDirty(this);
+    if(!v) {
+      m_canvas->invalidateCache();
       m_canvas->invalidate(m_last_rect, false);
+    }
     else
       changed();
   }
@@ -380,36 +1010,45 @@ void KGameCanvasItem::setAnimated(bool a) {
   m_animated = a;
   if(m_canvas) {
     if(a) {
-      m_canvas->m_animated_items.append(this);
+      m_canvas->linkAnimated(this);
       m_canvas->ensureAnimating();
     }
     else
-      m_canvas->m_animated_items.removeAll(this);
+      m_canvas->unlinkAnimated(this);
   }
 }
 
 void KGameCanvasItem::setOpacity(int o) {
   if (o<0) o=0;
   if (o>255) o = 255;
+  if(m_opacity == o)
+    return;
   m_opacity = o;
 
+  /* the opacity is applied when painting, the layer is still valid */
   if(m_canvas && m_visible)
-    changed();
+    changedKeepLayer();
 }
 
 bool KGameCanvasItem::layered() const { return true; }
 
 void KGameCanvasItem::advance(int /*msecs*/) { }
 
-void KGameCanvasItem::updateAfterRestack(int from, int to)
+void KGameCanvasItem::updateAfterRestack(KGameCanvasItem *lo, KGameCanvasItem *hi)
 {
-    int inc = from>to ? -1 : 1;
+    /* the items between the old and the new position */
+    quint64 lo_key = lo->m_stack_key;
+    quint64 hi_key = hi->m_stack_key;
+
+    m_canvas->invalidateCache();
 
     QRegion upd;
-    for(int i=from; i!=to;i+=inc)
+    QList<KGameCanvasItem*> items = m_canvas->m_index->query(rect(),
+                                      m_canvas->m_first_item, m_canvas->m_item_count);
+    for(int i=0; i<items.size();i++)
     {
-        KGameCanvasItem *el = m_canvas->m_items.at(i);
-        if(!el->m_visible)
+        KGameCanvasItem *el = items.at(i);
+        if(!el->m_visible || el == this || el->m_stack_key < lo_key || el->m_stack_key > hi_key)
             continue;
 
         QRect r = el->rect() & rect();
@@ -423,27 +1062,26 @@ void KGameCanvasItem::updateAfterRestack(int from, int to)
 
 void KGameCanvasItem::raise()
 {
-    if(!m_canvas || m_canvas->m_items.last() == this)
+    if(!m_canvas || !m_next)
         return;
 
-    int old_pos = m_canvas->m_items.indexOf(this);
-    m_canvas->m_items.removeAt(old_pos);
-    m_canvas->m_items.append(this);
+    KGameCanvasItem *old_next = m_next;
+    m_canvas->unlinkItem(this);
+    m_canvas->linkItem(this, m_canvas->m_last_item);
     if(m_visible)
-        updateAfterRestack(old_pos, m_canvas->m_items.size()-1);
+        updateAfterRestack(old_next, m_prev);
 }
 
 void KGameCanvasItem::lower()
 {
-    if(!m_canvas || m_canvas->m_items.first() == this)
+    if(!m_canvas || !m_prev)
         return;
 
-    int old_pos = m_canvas->m_items.indexOf(this);
-    m_canvas->m_items.removeAt(old_pos);
-    m_canvas->m_items.prepend(this);
-
+    KGameCanvasItem *old_prev = m_prev;
+    m_canvas->unlinkItem(this);
+    m_canvas->linkItem(this, NULL);
     if(m_visible)
-        updateAfterRestack(old_pos, 0);
+        updateAfterRestack(m_next, old_prev);
 }
 
 void KGameCanvasItem::stackOver(KGameCanvasItem* ref)
@@ -457,17 +1095,23 @@ void KGameCanvasItem::stackOver(KGameCanvasItem* ref)
         return;
     }
 
-    int i = m_canvas->m_items.indexOf( ref );
-    if(i < m_canvas->m_items.size()-2  &&  m_canvas->m_items[i+1] == this)
+    if(ref == this || ref->m_next == this)
         return;
 
-    int old_pos = m_canvas->m_items.indexOf(this);
-    m_canvas->m_items.removeAt(old_pos);
-    i = m_canvas->m_items.indexOf(ref);
-    m_canvas->m_items.insert(i+1,this);
-
-    if(m_visible)
-        updateAfterRestack(old_pos, i+1);
+    if(ref->m_stack_key > m_stack_key) {
+        KGameCanvasItem *old_next = m_next;
+        m_canvas->unlinkItem(this);
+        m_canvas->linkItem(this, ref);
+        if(m_visible)
+            updateAfterRestack(old_next, m_prev);
+    }
+    else {
+        KGameCanvasItem *old_prev = m_prev;
+        m_canvas->unlinkItem(this);
+        m_canvas->linkItem(this, ref);
+        if(m_visible)
+            updateAfterRestack(m_next, old_prev);
+    }
 }
 
 void KGameCanvasItem::stackUnder(KGameCanvasItem* ref)
@@ -482,17 +1126,23 @@ void KGameCanvasItem::stackUnder(KGameCanvasItem* ref)
         return;
     }
 
-    int i = m_canvas->m_items.indexOf( ref );
-    if(i >= 1  &&  m_canvas->m_items[i-1] == this)
+    if(ref == this || ref->m_prev == this)
         return;
 
-    int old_pos = m_canvas->m_items.indexOf(this);
-    m_canvas->m_items.removeAt(old_pos);
-    i = m_canvas->m_items.indexOf(ref);
-    m_canvas->m_items.insert(i,this);
-
-    if(m_visible)
-        updateAfterRestack(old_pos, i);
+    if(ref->m_stack_key > m_stack_key) {
+        KGameCanvasItem *old_next = m_next;
+        m_canvas->unlinkItem(this);
+        m_canvas->linkItem(this, ref->m_prev);
+        if(m_visible)
+            updateAfterRestack(old_next, m_prev);
+    }
+    else {
+        KGameCanvasItem *old_prev = m_prev;
+        m_canvas->unlinkItem(this);
+        m_canvas->linkItem(this, ref->m_prev);
+        if(m_visible)
+            updateAfterRestack(m_next, old_prev);
+    }
 }
 
 void KGameCanvasItem::moveTo(const QPoint &newpos)
@@ -500,6 +1150,8 @@ void KGameCanvasItem::moveTo(const QPoint &newpos)
   if(m_pos == newpos)
     return;
   m_pos = newpos;
+  if(m_canvas)
+    m_canvas->m_index->markDirty(this);
   if(m_visible && m_canvas)
     changed();
 }
@@ -520,7 +1172,9 @@ QPoint KGameCanvasItem::absolutePosition() const
 KGameCanvasGroup::KGameCanvasGroup(KGameCanvasAbstract* KGameCanvas)
 : KGameCanvasItem(KGameCanvas)
 , KGameCanvasAbstract()
-, m_child_rect_changed(true) {
+, m_child_rect_changed(true)
+, m_cached(false)
+, m_cache_dirty(true) {
 
 }
 
@@ -542,12 +1196,7 @@ void KGameCanvasGroup::ensurePendingUpdate() {
 void KGameCanvasGroup::updateChanges() {
   if(!m_changed)
     return;
-  for(int i=0;i<m_items.size();i++) {
-    KGameCanvasItem *el = m_items.at(i);
-
-    if(el->m_changed)
-      el->updateChanges();
-  }
+  updateChangedItems();
   m_changed = false;
 }
 
@@ -555,11 +1204,33 @@ void KGameCanvasGroup::changed() {
   if(!m_changed) {
     KGameCanvasItem::changed();
 
-    for(int i=0;i<m_items.size();i++)
-      m_items[i]->changed();
+    /* the children did not change, they are just painted elsewhere */
+    bool cache_dirty = m_cache_dirty;
+    for(KGameCanvasItem *el = m_first_item; el; el = el->m_next)
+      el->changedKeepLayer();
+    m_cache_dirty = cache_dirty;
   }
 }
 
+void KGameCanvasGroup::invalidateCache() {
+  m_cache_dirty = true;
+  if(m_canvas)
+    m_canvas->invalidateCache();
+}
+
+void KGameCanvasGroup::setCached(bool cached) {
+  if(m_cached == cached)
+    return;
+
+  m_cached = cached;
+  m_cache_dirty = true;
+  m_cache = QPixmap();
+
+  /* the opacity is applied differently when cached */
+  if(m_opacity < 255 && m_visible && m_canvas)
+    changed();
+}
+
 void KGameCanvasGroup::invalidate(const QRect& r, bool translate) {
   if(m_canvas)
     m_canvas->invalidate(translate ? r.translated(m_pos) : r, translate);
@@ -577,16 +1248,14 @@ void KGameCanvasGroup::invalidate(const QRegion& r, bool translate) {
 void KGameCanvasGroup::advance(int msecs) {
 
   // The list MUST be copied, because it could be modified calling advance.
-  // After all since it is implicitly shared the copy will not happen unless
-  // is it actually modified
-  QList<KGameCanvasItem*> ait = m_animated_items;
+  QList<KGameCanvasItem*> ait = animatedItems();
   for(int i=0;i<ait.size();i++)
   {
       KGameCanvasItem *el = ait[i];
       el->advance(msecs);
   }
 
-  if(m_animated_items.empty())
+  if(!m_first_animated)
       setAnimated(false);
 }
 
@@ -596,10 +1265,35 @@ void KGameCanvasGroup::paintInternal(QPainter* p, const QRect& prect,
 
   QPoint adelta = delta;
   adelta += m_pos;
+
+  if(m_cached) {
+    int opacity = int(cumulative_opacity*255 + 0.5);
+    QRect cr = rect().translated(-m_pos);
+    if(opacity <= 0 || cr.isEmpty())
+      return;
+
+    /* the cache is in the coordinates of the group, so moving the group only
+       moves the rects where the children remember to be painted */
+    if(m_cache_dirty || m_cache.size() != cr.size())
+      paintCache(cr, adelta);
+    else if(adelta != m_cache_delta)
+      moveChildRects(adelta - m_cache_delta);
+
+    QRect src = prect.translated(-adelta) & cr;
+    qreal old_opacity = p->opacity();
+    p->translate(m_pos);
+    p->setOpacity(old_opacity*opacity/255.0);
+    p->drawPixmap(src.topLeft(), m_cache, src.translated(-cr.topLeft()));
+    p->setOpacity(old_opacity);
+    p->translate(-m_pos);
+    return;
+  }
+
   p->translate(m_pos);
 
-  for(int i=0;i<m_items.size();i++) {
-    KGameCanvasItem *el = m_items.at(i);
+  QList<KGameCanvasItem*> items = m_index->query(prect.translated(-adelta), m_first_item, m_item_count);
+  for(int i=0;i<items.size();i++) {
+    KGameCanvasItem *el = items.at(i);
     QRect r = el->rect().translated(adelta);
 
     if( el->m_visible && prect.intersects( r ) && preg.contains( r ) ) {
@@ -611,6 +1305,39 @@ void KGameCanvasGroup::paintInternal(QPainter* p, const QRect& prect,
   p->translate(-m_pos);
 }
 
+void KGameCanvasGroup::paintCache(const QRect& cr, const QPoint& adelta) {
+  if(m_cache.size() != cr.size())
+    m_cache = QPixmap(cr.size());
+  m_cache.fill(Qt::transparent);
+
+  QPainter p(&m_cache);
+  p.translate(-cr.topLeft());
+
+  QRect prect = cr.translated(adelta);
+  QRegion preg(prect);
+  for(KGameCanvasItem *el = m_first_item; el; el = el->m_next) {
+    QRect r = el->rect().translated(adelta);
+
+    if( el->m_visible && prect.intersects( r ) ) {
+      el->m_last_rect = r;
+      el->paintInternal(&p,prect,preg,adelta,1.0);
+    }
+  }
+
+  m_cache_dirty = false;
+  m_cache_delta = adelta;
+}
+
+void KGameCanvasGroup::moveChildRects(const QPoint& d) {
+  /* groups inside the cache remember where their children were painted too */
+  m_cache_delta += d;
+  for(KGameCanvasItem *el = m_first_item; el; el = el->m_next) {
+    el->m_last_rect.translate(d);
+    if(KGameCanvasGroup *group = dynamic_cast<KGameCanvasGroup*>(el))
+      group->moveChildRects(d);
+  }
+}
+
 void KGameCanvasGroup::paint(QPainter* /*p*/) {
   Q_ASSERT(!"This function should never be called");
 }
@@ -622,9 +1349,8 @@ QRect KGameCanvasGroup::rect() const
 
   m_child_rect_changed = false;
   m_last_child_rect = QRect();
-  for(int i=0;i<m_items.size();i++)
+  for(KGameCanvasItem *el = m_first_item; el; el = el->m_next)
   {
-    KGameCanvasItem *el = m_items[i];
     if(el->m_visible)
       m_last_child_rect |= el->rect();
   }
@@ -701,18 +1427,121 @@ KGameCanvasRenderedPixmap::KGameCanvasRenderedPixmap(KGameRenderer* renderer, co
 {
 }
 
+KGameCanvasRenderedPixmap::~KGameCanvasRenderedPixmap()
+{
+	if (m_pendingCanvas)
+	{
+		m_pendingCanvas->cancelRenderSizeUpdate(this);
+	}
+}
+
 void KGameCanvasRenderedPixmap::receivePixmap(const QPixmap& pixmap)
 {
 	KGameCanvasPixmap::setPixmap(pixmap);
 }
 
+void KGameCanvasRenderedPixmap::setDisplaySize(const QSize& size)
+{
+	if (m_displaySize == size)
+	{
+		return;
+	}
+	const bool first = !m_displaySize.isValid();
+	m_displaySize = size;
+	if (visible() && canvas())
+	{
+		changed();
+	}
+	if (!size.isValid())
+	{
+		return;
+	}
+	//the first size is applied at once, later ones are merged by the canvas
+	KGameCanvasWidget* widget = topLevelCanvas();
+	if (first || !widget)
+	{
+		updateRenderSize();
+	}
+	else
+	{
+		widget->scheduleRenderSizeUpdate(this);
+	}
+}
+
+void KGameCanvasRenderedPixmap::updateRenderSize()
+{
+	if (!m_displaySize.isValid())
+	{
+		return;
+	}
+	KGameCanvasWidget* widget = topLevelCanvas();
+	const qreal scale = widget ? widget->renderScale() : 1.0;
+	setRenderSize(m_displaySize * scale);
+}
+
+void KGameCanvasRenderedPixmap::paint(QPainter* p)
+{
+	if (!m_displaySize.isValid())
+	{
+		KGameCanvasPixmap::paint(p);
+		return;
+	}
+	//while a new pixmap is pending, the old one is scaled
+	const QPixmap pix = pixmap();
+	if (pix.size() == m_displaySize)
+	{
+		p->drawPixmap(pos(), pix);
+	}
+	else
+	{
+		p->drawPixmap(rect(), pix);
+	}
+}
+
+QRect KGameCanvasRenderedPixmap::rect() const
+{
+	if (!m_displaySize.isValid())
+	{
+		return KGameCanvasPixmap::rect();
+	}
+	return QRect(pos(), m_displaySize);
+}
+
 /*
     KGameCanvasTiledPixmap
 */
+/* tiles smaller than this are repeated into a bigger pixmap, because drawing
+   many small tiles is slow */
+enum { MinTileSize = 128 };
+
+static QPixmap expandedTile(const QPixmap& pixmap) {
+  if(pixmap.isNull() || (pixmap.width() >= MinTileSize && pixmap.height() >= MinTileSize))
+    return pixmap;
+
+  /* the same tile is often used by many items, share the expanded pixmap */
+  const QString key = QString::fromLatin1("kgamecanvas-tile-%1").arg(pixmap.cacheKey());
+  QPixmap tile;
+  if(QPixmapCache::find(key, &tile))
+    return tile;
+
+  int w = pixmap.width() * ((MinTileSize + pixmap.width() - 1) / pixmap.width());
+  int h = pixmap.height() * ((MinTileSize + pixmap.height() - 1) / pixmap.height());
+  tile = QPixmap(w, h);
+  tile.fill(Qt::transparent);
+  {
+    QPainter p(&tile);
+    p.setCompositionMode(QPainter::CompositionMode_Source);
+    p.drawTiledPixmap(tile.rect(), pixmap);
+  }
+  QPixmapCache::insert(key, tile);
+  return tile;
+}
+
 KGameCanvasTiledPixmap::KGameCanvasTiledPixmap(const QPixmap& pixmap, const QSize &size, const QPoint &origin,
                         bool move_orig, KGameCanvasAbstract* KGameCanvas)
     : KGameCanvasItem(KGameCanvas)
     , m_pixmap(pixmap)
+    , m_tile(expandedTile(pixmap))
     , m_size(size)
     , m_origin(origin)
     , m_move_orig(move_orig) {
@@ -733,6 +1562,7 @@ KGameCanvasTiledPixmap::~KGameCanvasTiledPixmap() {
 
 void KGameCanvasTiledPixmap::setPixmap(const QPixmap& pixmap) {
     m_pixmap = pixmap;
+    m_tile = expandedTile(pixmap);
     if(visible() && canvas() )
       changed();
 }
@@ -761,12 +1591,37 @@ void KGameCanvasTiledPixmap::setMoveOrigin(bool move_orig)
   m_move_orig = move_orig;
 }
 
+QPoint KGameCanvasTiledPixmap::tileOffset() const
+{
+    return m_move_orig ? m_origin : m_origin+pos();
+}
+
 void KGameCanvasTiledPixmap::paint(QPainter* p)
 {
-    if(m_move_orig)
-        p->drawTiledPixmap( rect(), m_pixmap, m_origin);
-    else
-        p->drawTiledPixmap( rect(), m_pixmap, m_origin+pos() );
+    p->drawTiledPixmap( rect(), m_tile, tileOffset() );
+}
+
+void KGameCanvasTiledPixmap::paintInternal(QPainter* p, const QRect& /*prect*/,
+          const QRegion& preg, const QPoint& delta, double cumulative_opacity)
+{
+    int op = int(cumulative_opacity*opacity() + 0.5);
+    if(op <= 0)
+        return;
+
+    /* only paint the exposed parts, which can be much smaller than a
+       background covering the whole canvas */
+    QRect r = rect();
+    QPoint offset = tileOffset();
+    qreal old_opacity = p->opacity();
+    if(op < 255)
+        p->setOpacity(old_opacity*op/255.0);
+    foreach(const QRect& exposed, preg.rects()) {
+        QRect sub = exposed.translated(-delta) & r;
+        if(!sub.isEmpty())
+            p->drawTiledPixmap( sub, m_tile, offset + (sub.topLeft() - r.topLeft()) );
+    }
+    if(op < 255)
+        p->setOpacity(old_opacity);
 }
 
 QRect KGameCanvasTiledPixmap::rect() const
@@ -832,7 +1687,8 @@ KGameCanvasText::KGameCanvasText(const QString& text, const QColor& color,
     , m_color(color)
     , m_font(font)
     , m_hpos(hp)
-    , m_vpos(vp) {
+    , m_vpos(vp)
+    , m_ascent(0) {
     calcBoundingRect();
 }
 
@@ -842,8 +1698,9 @@ KGameCanvasText::KGameCanvasText(KGameCanvasAbstract* KGameCanvas)
     , m_color(Qt::black)
     , m_font(QApplication::font())
     , m_hpos(HStart)
-    , m_vpos(VBaseline) {
-
+    , m_vpos(VBaseline)
+    , m_ascent(0) {
+    calcBoundingRect();
 }
 
 KGameCanvasText::~KGameCanvasText() {
@@ -851,7 +1708,15 @@ KGameCanvasText::~KGameCanvasText() {
 }
 
 void KGameCanvasText::calcBoundingRect() {
-    m_bounding_rect = QFontMetrics(m_font).boundingRect(m_text);
+    QFontMetrics fm(m_font);
+    m_bounding_rect = fm.boundingRect(m_text);
+    m_ascent = fm.ascent();
+
+    /* lay out the text once, instead of every time it is painted */
+    m_static_text.setTextFormat(Qt::PlainText);
+    m_static_text.setPerformanceHint(QStaticText::AggressiveCaching);
+    m_static_text.setText(m_text);
+    m_static_text.prepare(QTransform(), m_font);
     /*printf("b rect is %d %d %d %d\n",
         m_bounding_rect.x(),
         m_bounding_rect.y(),
@@ -927,7 +1792,8 @@ QPoint KGameCanvasText::offsetToDrawPos() const {
 void KGameCanvasText::paint(QPainter* p) {
   p->setPen(m_color);
   p->setFont(m_font);
-  p->drawText( pos() + offsetToDrawPos(), m_text);
+  /* static text is positioned by its top, not by the baseline */
+  p->drawStaticText( pos() + offsetToDrawPos() - QPoint(0, m_ascent), m_static_text);
 }
 
 QRect KGameCanvasText::rect() const {
@@ -982,7 +1848,7 @@ QRect KGameCanvasAdapter::childRect()
 {
     if (!m_child_rect_valid) {
         m_child_rect = QRect();
-        foreach (KGameCanvasItem* el, m_items) {
+        for (KGameCanvasItem* el = m_first_item; el; el = el->m_next) {
             m_child_rect |= el->rect();
         }
         m_child_rect_valid = true;
@@ -993,7 +1859,7 @@ QRect KGameCanvasAdapter::childRect()
 
 void KGameCanvasAdapter::render(QPainter *painter)
 {
-    foreach (KGameCanvasItem* el, m_items) {
+    for (KGameCanvasItem* el = m_first_item; el; el = el->m_next) {
         if (el->m_visible) {
             el->m_last_rect = el->rect();
             el->paintInternal(painter, childRect(), childRect(), QPoint(), 1.0);
@@ -1005,11 +1871,7 @@ void KGameCanvasAdapter::ensurePendingUpdate()
 {
     m_child_rect_valid = false;
 
-    foreach (KGameCanvasItem* el, m_items) {
-        if (el->m_changed) {
-            el->updateChanges();
-        }
-    }
+    updateChangedItems();
 
     updateParent(m_invalidated_rect);
     m_invalidated_rect = QRect();
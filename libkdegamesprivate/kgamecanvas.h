@@ -33,16 +33,21 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <QtCore/QList>
 #include <QtCore/QPoint>
+#include <QtCore/QPointer>
+#include <QtGui/QImage>
 #include <QtGui/QPicture>
 #include <QtGui/QPixmap>
 #include <QtGui/QPainter>
 #include <QtCore/QRect>
 #include <QtGui/QRegion>
+#include <QtGui/QStaticText>
 #include <QtWidgets/QWidget>
 #include "libkdegamesprivate_export.h"
 #include <KGameRendererClient>
 
 class KGameCanvasItem;
+class KGameCanvasSpatialIndex;
+class KGameCanvasWidget;
 
 /**
     \class KGameCanvasAbstract kgamecanvas.h <KGameCanvas>
@@ -57,8 +62,47 @@ class KDEGAMESPRIVATE_EXPORT KGameCanvasAbstract
 protected:
     friend class KGameCanvasItem;
 
-    QList<KGameCanvasItem*> m_items;
-    QList<KGameCanvasItem*> m_animated_items;
+    /* the items in stacking order (bottom to top), linked through the items */
+    KGameCanvasItem *m_first_item;
+    KGameCanvasItem *m_last_item;
+    int m_item_count;
+
+    /* the animated items, linked through the items */
+    KGameCanvasItem *m_first_animated;
+    KGameCanvasItem *m_last_animated;
+
+    /* the items as a list, only built when items() is called */
+    mutable QList<KGameCanvasItem*> m_items;
+    mutable bool m_items_valid;
+
+    QList<KGameCanvasItem*> m_changed_items;
+
+    /* grid of the visible items, used to find the items in a rect quickly */
+    KGameCanvasSpatialIndex *m_index;
+
+    /* inserts an item in the stacking order over after (or at the bottom if
+       after is NULL), and removes it again */
+    void linkItem(KGameCanvasItem *el, KGameCanvasItem *after);
+    void unlinkItem(KGameCanvasItem *el);
+
+    /* spreads the stack keys of el and its neighbours when el got no room */
+    void renumberItems(KGameCanvasItem *el);
+
+    /* appends an item to the animated items, and removes it again */
+    void linkAnimated(KGameCanvasItem *el);
+    void unlinkAnimated(KGameCanvasItem *el);
+
+    /* returns a copy of the animated items, which may be modified while advancing them */
+    QList<KGameCanvasItem*> animatedItems() const;
+
+    /* called when the appearance of a child item changed, to drop cached renderings */
+    virtual void invalidateCache();
+
+    /* calls updateChanges on the changed items, returns how many there were */
+    int updateChangedItems();
+
+    /* paints the visible items in the given rect and region */
+    void paintItems(QPainter* p, const QRect& prect, const QRegion& preg);
 
 public:
     /** The constructor */
@@ -66,8 +110,10 @@ public:
 
     virtual ~KGameCanvasAbstract();
 
-    /** Returns a const pointer to the list holding all the items in the canvas */
-    const QList<KGameCanvasItem*>* items() const { return &m_items; }
+    /** Returns a const pointer to the list holding all the items in the canvas,
+        in stacking order. The list is only updated by calling this function
+        again, so don't keep it around after adding, removing or restacking items */
+    const QList<KGameCanvasItem*>* items() const;
 
     /** Helper function to retrieve the topmost item at the given position */
     KGameCanvasItem* itemAt(const QPoint &pos) const;
@@ -118,6 +164,7 @@ private:
     friend class KGameCanvasWidget;
     friend class KGameCanvasGroup;
     friend class KGameCanvasAdapter;
+    friend class KGameCanvasSpatialIndex;
 
     bool m_visible;
     bool m_animated;
@@ -128,12 +175,32 @@ private:
     bool m_changed;
     QRect m_last_rect;
 
-    static QPixmap* transparence_pixmap_cache;
-    static QPixmap* getTransparenceCache(const QSize &s);
+    /* neighbours in the canvas' stacking order and in the canvas' animated
+       items. The stack keys grow from the bottom to the top, with gaps in
+       between, so that restacking does not need to renumber the items */
+    KGameCanvasItem *m_prev;
+    KGameCanvasItem *m_next;
+    quint64 m_stack_key;
+    KGameCanvasItem *m_anim_prev;
+    KGameCanvasItem *m_anim_next;
+
+    /* rect stored in the canvas' spatial index */
+    QRect m_index_rect;
+    unsigned m_index_stamp;
+
+    /* the item painted offscreen, used to paint layered items with opacity */
+    QPixmap m_layer;
+    bool m_layer_dirty;
+
+    /* like changed(), but the item itself looks the same, so the layer stays valid */
+    void changedKeepLayer();
+
     virtual void paintInternal(QPainter* p, const QRect& prect, const QRegion& preg,
                                           const QPoint &delta, double cumulative_opacity);
 
-    void updateAfterRestack(int from, int to);
+    /* repaints after restacking, lo and hi are the lowest and highest
+       items which have been stacked over or under this item */
+    void updateAfterRestack(KGameCanvasItem *lo, KGameCanvasItem *hi);
 
     /* function to update pending changes, called from parent */
     virtual void updateChanges();
@@ -221,7 +288,9 @@ public:
     /** Override this function to specify if the painting operations will paint over
         each other. If not, the item will be drawn more quickly when opacity is != 255,
         because it does not have to be painted onto a pixmap first. If you don't care
-        about the item's opacity, don't care about this function as well. */
+        about the item's opacity, don't care about this function as well.
+        The pixmap of a layered item is kept until changed() is called, so that
+        fading the item does not paint it again. */
     virtual bool layered() const;
 
     /** Override this function to handle animations, the default function does nothing.
@@ -272,6 +341,15 @@ private:
     mutable bool m_child_rect_changed;
     mutable QRect m_last_child_rect;
 
+    /* rendering of the children, see setCached */
+    bool m_cached;
+    bool m_cache_dirty;
+    QPixmap m_cache;
+    QPoint m_cache_delta; /* the offset m_last_rect of the children is based on */
+
+    void paintCache(const QRect& cr, const QPoint& adelta);
+    void moveChildRects(const QPoint& d);
+
     virtual void paintInternal(QPainter* p, const QRect& prect, const QRegion& preg,
                                           const QPoint& delta, double cumulative_opacity);
 
@@ -281,6 +359,7 @@ private:
     virtual void invalidate(const QRegion& r, bool translate = true);
     virtual void updateChanges();
     virtual void changed();
+    virtual void invalidateCache();
 
 public:
     /** Constructor */
@@ -288,6 +367,16 @@ public:
 
     virtual ~KGameCanvasGroup();
 
+    /** Returns true if the group keeps a rendering of its children */
+    bool cached() const { return m_cached; }
+
+    /** Set if the group should keep a rendering of its children in a pixmap,
+        which is only painted again when any of the children changes. This is
+        useful for groups of many items that rarely change, like backgrounds.
+        Note that the opacity of a cached group is applied to the group as a
+        whole, and not to each child. */
+    void setCached(bool cached);
+
     /** This paints all the children */
     virtual void paint(QPainter* p);
 
@@ -382,8 +471,30 @@ class KDEGAMESPRIVATE_EXPORT KGameCanvasRenderedPixmap : public KGameCanvasPixma
 {
 public:
 	KGameCanvasRenderedPixmap(KGameRenderer* renderer, const QString& spriteKey, KGameCanvasAbstract* canvas = 0);
+	virtual ~KGameCanvasRenderedPixmap();
+
+	///@return the size of the item on the canvas, or an invalid size if
+	///the item is as big as the pixmap
+	QSize displaySize() const { return m_displaySize; }
+	///Defines the size of the item on the canvas. The render size is then
+	///chosen automatically, such that the pixmap matches the pixels of the
+	///canvas widget (see KGameCanvasWidget::renderScale()).
+	///
+	///When the display size changes many times in a row (e.g. while the
+	///window is being resized), the old pixmap is scaled until the changes
+	///are over, and only then a new pixmap is requested from the renderer.
+	void setDisplaySize(const QSize& size);
+
+	virtual void paint(QPainter* p);
+	virtual QRect rect() const;
 protected:
 	virtual void receivePixmap(const QPixmap& pixmap);
+private:
+	friend class KGameCanvasWidget;
+	QSize m_displaySize;
+	QPointer<KGameCanvasWidget> m_pendingCanvas;
+
+	void updateRenderSize();
 };
 
 /**
@@ -398,10 +509,15 @@ class KDEGAMESPRIVATE_EXPORT  KGameCanvasTiledPixmap : public KGameCanvasItem
 {
 private:
     QPixmap m_pixmap;
+    QPixmap m_tile; /* m_pixmap repeated to a bigger tile, shared between items */
     QSize m_size;
     QPoint m_origin;
     bool m_move_orig;
 
+    QPoint tileOffset() const;
+    virtual void paintInternal(QPainter* p, const QRect& prect, const QRegion& preg,
+                                          const QPoint& delta, double cumulative_opacity);
+
 public:
     /** Constructor, specifying the pixmap and the parameters to use */
     KGameCanvasTiledPixmap(const QPixmap& pixmap, const QSize &size, const QPoint &origin,
@@ -514,6 +630,8 @@ private:
     HPos m_hpos;
     VPos m_vpos;
     QRect m_bounding_rect;
+    int m_ascent;
+    QStaticText m_static_text; /* laid out text, updated with text and font */
 
     QPoint offsetToDrawPos() const;
     void calcBoundingRect();
@@ -589,6 +707,12 @@ private:
 private Q_SLOTS:
     void processAnimations();
     void updateChanges();
+    void updateRenderSizes();
+
+private:
+    friend class KGameCanvasRenderedPixmap;
+    void scheduleRenderSizeUpdate(KGameCanvasRenderedPixmap* item);
+    void cancelRenderSizeUpdate(KGameCanvasRenderedPixmap* item);
 
 public:
     /** The constructor */
@@ -596,9 +720,40 @@ public:
 
     virtual ~KGameCanvasWidget();
 
-    /** Set the delay of the animation, in milliseconds */
+    /** Set the delay of the animation, in milliseconds. The default is 16
+        msecs, i.e. about 60 frames per second. If nothing changes for a while
+        although there are animated items, the animation slows down until any
+        item changes again. A delay of 0 advances the animations as fast as
+        possible. */
     void setAnimationDelay(int d);
 
+    /** Returns the delay of the animation, in milliseconds */
+    int animationDelay() const;
+
+    /** Set the delay of the animation in frames per second, see setAnimationDelay */
+    void setFrameRate(int fps);
+
+    /** Returns the frames per second of the animation, or 0 if unlimited */
+    int frameRate() const;
+
+    /** Returns how many device pixels correspond to a pixel of the canvas,
+        see KGameCanvasRenderedPixmap::setDisplaySize */
+    qreal renderScale() const;
+
+    /** Returns how many items (not counting the items inside groups) changed
+        in the last update of the canvas */
+    int lastUpdateChangedItems() const;
+
+    /** Returns how many rects have been invalidated in the last update. The
+        rects are merged before repainting, see lastUpdatePaintedRects */
+    int lastUpdateInvalidatedRects() const;
+
+    /** Returns how many rects have been repainted in the last update */
+    int lastUpdatePaintedRects() const;
+
+    /** Returns how many pixels have been repainted in the last update */
+    int lastUpdatePaintedArea() const;
+
     /** Return the number of millisecons from the creation of the canvas
         (see also KGameCanvasItem::advance)*/
     int mSecs();
@@ -681,4 +836,63 @@ public:
     virtual void updateParent(const QRect& rect) = 0;
 };
 
+/**
+    \class KGameCanvasImage kgamecanvas.h <KGameCanvas>
+    \brief Offscreen canvas.
+
+    A KGameCanvasImage is a canvas that paints its items into a QImage instead
+    of a widget, so it can be used without a display, e.g. for tests or to
+    create thumbnails. Like with KGameCanvasWidget, only the parts of the
+    image that changed are painted again when image() is called.
+
+    A KGameCanvasImage does not need an event loop. Animations are not advanced
+    automatically, call advance() to do so. Like the other canvases, it may
+    only be used from the GUI thread, because the items, their layers and the
+    caches of groups are painted through QPixmaps.
+
+    \deprecated For new applications, use Qt's Graphics View framework or Qt Quick.
+*/
+class KDEGAMESPRIVATE_EXPORT KGameCanvasImage : public KGameCanvasAbstract
+{
+private:
+    class KGameCanvasImagePrivate *priv;
+
+    virtual void ensureAnimating();
+    virtual void ensurePendingUpdate();
+    virtual void invalidate(const QRect& r, bool translate = true);
+    virtual void invalidate(const QRegion& r, bool translate = true);
+
+public:
+    /** Constructor, specifying the size and the format of the image */
+    explicit KGameCanvasImage(const QSize& size, QImage::Format format = QImage::Format_ARGB32_Premultiplied);
+
+    virtual ~KGameCanvasImage();
+
+    /** Returns the size of the image */
+    QSize size() const;
+
+    /** Sets the size of the image, which will be painted again completely */
+    void resize(const QSize& size);
+
+    /** Returns the color the image is filled with before painting the items */
+    QColor backgroundColor() const;
+
+    /** Sets the color the image is filled with before painting the items,
+        the default is Qt::transparent */
+    void setBackgroundColor(const QColor& color);
+
+    /** Advances the animated items to the given time in milliseconds,
+        see KGameCanvasItem::advance */
+    void advance(int msecs);
+
+    /** Paints the pending changes and returns the image */
+    const QImage& image();
+
+    /** An image is not associated to any widget, so this returns 0 */
+    virtual class KGameCanvasWidget* topLevelCanvas();
+
+    /** @return The point (0, 0) */
+    virtual QPoint canvasPosition() const;
+};
+
 #endif //__KGRGAMECANVAS_H__
@@ -34,16 +34,16 @@
 # error "into your own source tree."
 #endif
 
-/* needed for KDE_EXPORT and KDE_IMPORT macros */
-#include <kdemacros.h>
+/* needed for Q_DECL_EXPORT and Q_DECL_IMPORT macros */
+#include <QtCore/qglobal.h>
 
 #ifndef KDEGAMESPRIVATE_EXPORT
 # if defined(MAKE_KDEGAMESPRIVATE_LIB)
    /* We are building this library */ 
-#  define KDEGAMESPRIVATE_EXPORT KDE_EXPORT
+#  define KDEGAMESPRIVATE_EXPORT Q_DECL_EXPORT
 # else
    /* We are using this library */ 
-#  define KDEGAMESPRIVATE_EXPORT KDE_IMPORT
+#  define KDEGAMESPRIVATE_EXPORT Q_DECL_IMPORT
 # endif
 #endif
 
@@ -0,0 +1,253 @@
+#include <QtTest>
+
+#include "kgamecanvastest.h"
+
+// items visible at pos, topmost first, determined by scanning all items
+static QList<KGameCanvasItem*> referenceItemsAt(const KGameCanvasAbstract& canvas, const QPoint& pos)
+{
+    QList<KGameCanvasItem*> retv;
+    const QList<KGameCanvasItem*>& items = *canvas.items();
+    for (int i = items.size() - 1; i >= 0; --i) {
+        if (items[i]->visible() && items[i]->rect().contains(pos))
+            retv << items[i];
+    }
+    return retv;
+}
+
+// creates a board of size x size tiles with 16x16 pixels each
+static QList<KGameCanvasItem*> createBoard(KGameCanvasAbstract* canvas, int size)
+{
+    QList<KGameCanvasItem*> tiles;
+    for (int x = 0; x < size; ++x) {
+        for (int y = 0; y < size; ++y) {
+            KGameCanvasRectangle* tile = new KGameCanvasRectangle(Qt::darkGreen, QSize(16, 16), canvas);
+            tile->moveTo(x * 16, y * 16);
+            tile->show();
+            tiles << tile;
+        }
+    }
+    return tiles;
+}
+
+void tst_KGameCanvas::itemsAt()
+{
+    KGameCanvasWidget canvas;
+    QList<KGameCanvasItem*> tiles = createBoard(&canvas, 20);
+    KGameCanvasRectangle background(Qt::black, QSize(2000, 2000), &canvas);
+    background.moveTo(-500, -500);
+    background.show();
+    background.lower();
+
+    // overlapping items of different sizes
+    for (int i = 0; i < 50; ++i) {
+        KGameCanvasRectangle* item = new KGameCanvasRectangle(Qt::red, QSize(10 + i * 3, 30), &canvas);
+        item->moveTo((i * 37) % 300 - 20, (i * 53) % 300 - 20);
+        item->show();
+        tiles << item;
+    }
+    // modify the stacking order and geometry
+    for (int i = 0; i < tiles.size(); i += 7)
+        tiles[i]->raise();
+    for (int i = 3; i < tiles.size(); i += 11)
+        tiles[i]->lower();
+    for (int i = 5; i < tiles.size(); i += 13)
+        tiles[i]->stackOver(tiles[(i * 17) % tiles.size()]);
+    for (int i = 1; i < tiles.size(); i += 9)
+        tiles[i]->moveTo(tiles[i]->pos() + QPoint(200, 70));
+    for (int i = 2; i < tiles.size(); i += 5)
+        tiles[i]->hide();
+
+    for (int x = -30; x < 500; x += 7) {
+        for (int y = -30; y < 400; y += 11) {
+            const QPoint pos(x, y);
+            const QList<KGameCanvasItem*> reference = referenceItemsAt(canvas, pos);
+            QCOMPARE(canvas.itemsAt(pos), reference);
+            QCOMPARE(canvas.itemAt(pos), reference.isEmpty() ? (KGameCanvasItem*)0 : reference.first());
+        }
+    }
+
+    qDeleteAll(tiles);
+}
+
+static QImage renderCanvas(KGameCanvasWidget* canvas)
+{
+    QImage image(canvas->size(), QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::white);
+    canvas->render(&image);
+    return image;
+}
+
+void tst_KGameCanvas::cachedGroup()
+{
+    KGameCanvasWidget canvas;
+    canvas.resize(200, 200);
+    KGameCanvasGroup group(&canvas);
+    group.moveTo(10, 20);
+    group.show();
+    QList<KGameCanvasItem*> tiles = createBoard(&group, 8);
+    tiles[3]->hide();
+
+    const QImage uncached = renderCanvas(&canvas);
+    group.setCached(true);
+    QCOMPARE(renderCanvas(&canvas), uncached);
+
+    // the cache must follow changes of the children and of the group
+    tiles[5]->moveTo(100, 100);
+    tiles[3]->show();
+    tiles[7]->raise();
+    group.moveTo(30, 5);
+    const QImage cached = renderCanvas(&canvas);
+    group.setCached(false);
+    QCOMPARE(renderCanvas(&canvas), cached);
+
+    qDeleteAll(tiles);
+}
+
+void tst_KGameCanvas::updateCoalescing()
+{
+    KGameCanvasWidget canvas;
+    canvas.resize(1600, 1600);
+    QList<KGameCanvasItem*> tiles = createBoard(&canvas, 100);
+    QCoreApplication::processEvents();
+
+    int moved = 0;
+    for (int i = 0; i < tiles.size(); i += 37, ++moved)
+        tiles[i]->moveTo(tiles[i]->pos() + QPoint(3, 3));
+    QCoreApplication::processEvents();
+
+    QCOMPARE(canvas.lastUpdateChangedItems(), moved);
+    QVERIFY(canvas.lastUpdateInvalidatedRects() >= moved);
+    QVERIFY(canvas.lastUpdatePaintedRects() <= 32);
+    QVERIFY(canvas.lastUpdatePaintedArea() >= moved * 16 * 16);
+
+    qDeleteAll(tiles);
+}
+
+void tst_KGameCanvas::repeatedStacking()
+{
+    KGameCanvasWidget canvas;
+    QList<KGameCanvasItem*> tiles = createBoard(&canvas, 4);
+    KGameCanvasItem* base = tiles[5];
+
+    // every item goes directly over base, i.e. between base and the item
+    // stacked there before, which exhausts the room between their keys
+    QList<KGameCanvasItem*> stack;
+    for (int i = 0; i < 2000; ++i) {
+        KGameCanvasRectangle* item = new KGameCanvasRectangle(Qt::red, QSize(16, 16), &canvas);
+        item->moveTo(base->pos());
+        item->show();
+        item->stackOver(base);
+        stack.append(item);
+    }
+    tiles << stack;
+
+    const QList<KGameCanvasItem*> reference = referenceItemsAt(canvas, base->pos());
+    QCOMPARE(canvas.itemsAt(base->pos()), reference);
+    QCOMPARE(reference.mid(0, stack.size()), stack);
+    QCOMPARE(reference.last(), base);
+
+    qDeleteAll(tiles);
+}
+
+void tst_KGameCanvas::offscreenImage()
+{
+    KGameCanvasImage canvas(QSize(200, 200));
+    canvas.setBackgroundColor(Qt::white);
+    QList<KGameCanvasItem*> tiles = createBoard(&canvas, 10);
+    KGameCanvasRectangle marker(Qt::red, QSize(20, 20), &canvas);
+    marker.show();
+    QCOMPARE(canvas.image().pixel(5, 5), QColor(Qt::red).rgb());
+    QCOMPARE(canvas.image().pixel(190, 190), QColor(Qt::white).rgb());
+
+    // partially update the image
+    marker.moveTo(50, 50);
+    marker.setOpacity(128);
+    tiles[0]->hide();
+    const QImage updated = canvas.image();
+
+    // paint everything again
+    canvas.resize(QSize(100, 100));
+    canvas.resize(QSize(200, 200));
+    QCOMPARE(canvas.image(), updated);
+    QCOMPARE(updated.pixel(5, 5), QColor(Qt::white).rgb());
+
+    qDeleteAll(tiles);
+}
+
+void tst_KGameCanvas::tiledPixmap()
+{
+    // a small tile with a different color in each pixel
+    QImage tileImage(5, 3, QImage::Format_ARGB32_Premultiplied);
+    for (int x = 0; x < 5; ++x)
+        for (int y = 0; y < 3; ++y)
+            tileImage.setPixel(x, y, qRgb(x * 50, y * 100, 255));
+    const QPixmap tile = QPixmap::fromImage(tileImage);
+
+    KGameCanvasImage canvas(QSize(300, 200));
+    canvas.setBackgroundColor(Qt::white);
+    KGameCanvasTiledPixmap tiled(tile, QSize(200, 150), QPoint(3, 2), false, &canvas);
+    tiled.moveTo(7, 9);
+    tiled.show();
+    KGameCanvasRectangle cover(Qt::black, QSize(30, 30), &canvas);
+    cover.moveTo(50, 60);
+    cover.show();
+    canvas.image();
+
+    // only repaint the area below the rectangle
+    cover.hide();
+
+    QImage expected(canvas.size(), QImage::Format_ARGB32_Premultiplied);
+    expected.fill(Qt::white);
+    QPainter p(&expected);
+    p.drawTiledPixmap(QRect(7, 9, 200, 150), tile, QPoint(3, 2) + QPoint(7, 9));
+    p.end();
+    QCOMPARE(canvas.image(), expected);
+}
+
+void tst_KGameCanvas::benchmarkItemsAt()
+{
+    KGameCanvasWidget canvas;
+    QList<KGameCanvasItem*> tiles = createBoard(&canvas, 100);
+
+    QBENCHMARK {
+        for (int i = 0; i < 1000; ++i)
+            canvas.itemAt((i * 37) % 1600, (i * 91) % 1600);
+    }
+
+    qDeleteAll(tiles);
+}
+
+void tst_KGameCanvas::benchmarkRestack()
+{
+    KGameCanvasWidget canvas;
+    QList<KGameCanvasItem*> tiles = createBoard(&canvas, 100);
+
+    QBENCHMARK {
+        for (int i = 0; i < 1000; ++i) {
+            tiles[(i * 37) % tiles.size()]->raise();
+            tiles[(i * 91) % tiles.size()]->stackUnder(tiles[(i * 53) % tiles.size()]);
+            tiles[(i * 17) % tiles.size()]->lower();
+        }
+    }
+
+    qDeleteAll(tiles);
+}
+
+void tst_KGameCanvas::benchmarkPartialPaint()
+{
+    KGameCanvasWidget canvas;
+    canvas.resize(1600, 1600);
+    QList<KGameCanvasItem*> tiles = createBoard(&canvas, 100);
+    QImage target(canvas.size(), QImage::Format_ARGB32_Premultiplied);
+
+    QBENCHMARK {
+        for (int i = 0; i < 100; ++i)
+            canvas.render(&target, QPoint(), QRegion((i * 37) % 1600, (i * 91) % 1600, 32, 32));
+    }
+
+    qDeleteAll(tiles);
+}
+
+QTEST_MAIN(tst_KGameCanvas)
+
+#include "kgamecanvastest.moc"
@@ -0,0 +1,44 @@
+#ifndef KGAMECANVASTEST_H
+#define KGAMECANVASTEST_H
+
+#include <QObject>
+
+#define USE_UNSTABLE_LIBKDEGAMESPRIVATE_API
+#include <kgamecanvas.h>
+
+class tst_KGameCanvas : public QObject
+{
+    Q_OBJECT
+
+// Declare test functions as private slots, or they won't get executed
+private slots:
+
+    /// @brief Compare itemAt/itemsAt with a linear scan after moving, hiding and restacking items
+    void itemsAt();
+
+    /// @brief Check that a cached group is painted like an uncached one, also after changes
+    void cachedGroup();
+
+    /// @brief Check that the rects invalidated by many moving items are merged
+    void updateCoalescing();
+
+    /// @brief Check the stacking order after many items were inserted at the same position
+    void repeatedStacking();
+
+    /// @brief Check that incremental updates of a KGameCanvasImage match a full repaint
+    void offscreenImage();
+
+    /// @brief Check that tiled pixmaps with small tiles are painted correctly, also partially
+    void tiledPixmap();
+
+    /// @brief Hit-testing on a board with 10000 tiles
+    void benchmarkItemsAt();
+
+    /// @brief Raising and lowering tiles of a board with 10000 tiles
+    void benchmarkRestack();
+
+    /// @brief Partial repaints of a board with 10000 tiles
+    void benchmarkPartialPaint();
+};
+
+#endif // KGAMECANVASTEST_H
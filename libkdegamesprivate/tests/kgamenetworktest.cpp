@@ -0,0 +1,186 @@
+#include <QtTest>
+
+#include "kgamenetworktest.h"
+#include "kgame/kgamemessage.h"
+#include "kgame/kmessageclient.h"
+
+static const int userMsgid = KGameMessage::IdUser + 1;
+
+static QByteArray compressibleData(int size)
+{
+    return QByteArray("the same line over and over again\n").repeated(size / 34 + 1).left(size);
+}
+
+static QByteArray incompressibleData(int size)
+{
+    QByteArray data(size, 0);
+    quint32 state = 12345;
+    for (int i = 0; i < size; ++i) {
+        state = state * 1103515245 + 12345;
+        data[i] = char(state >> 24);
+    }
+    return data;
+}
+
+// the id of a message as it went over the wire
+static int rawMsgid(const QSignalSpy& spy, int index)
+{
+    QDataStream stream(spy.at(index).at(0).toByteArray());
+    quint32 sender, receiver;
+    int msgid;
+    KGameMessage::extractHeader(stream, sender, receiver, msgid);
+    return msgid;
+}
+
+void TestNetwork::setupOldClient(quint32 clientID)
+{
+    QByteArray buffer;
+    QDataStream stream(&buffer, QIODevice::WriteOnly);
+    stream << qint16(KGameMessage::version()) << qint32(cookie());
+    sendSystemMessage(stream, KGameMessage::IdSetupGame, clientID);
+}
+
+void TestNetwork::networkTransmission(QDataStream& stream, int msgid, quint32, quint32, quint32)
+{
+    msgids << msgid;
+    messages << stream.device()->readAll();
+}
+
+void tst_KGameNetwork::init()
+{
+    qRegisterMetaType<QList<quint32> >("QList<quint32>");
+
+    mMaster = new TestNetwork(this);
+    mClient = new TestNetwork(this);
+    QVERIFY(mMaster->offerConnections(0));
+    QVERIFY(mClient->connectToServer(QStringLiteral("127.0.0.1"), mMaster->port()));
+    QTRY_COMPARE(mMaster->messageClient()->clientList().count(), 2);
+    QTRY_COMPARE(mClient->messageClient()->clientList().count(), 2);
+    QVERIFY(mClient->gameId() != 0);
+}
+
+void tst_KGameNetwork::cleanup()
+{
+    delete mClient;
+    delete mMaster;
+}
+
+void tst_KGameNetwork::roundTrip()
+{
+    QSignalSpy raw(mClient->messageClient(), SIGNAL(forwardReceived(QByteArray,quint32,QList<quint32>)));
+    mMaster->setPeerCapabilities(mClient->gameId(), KGameMessage::CapCompression);
+
+    const QByteArray msg = compressibleData(100000);
+    QVERIFY(mMaster->sendSystemMessage(msg, userMsgid, mClient->gameId()));
+    QTRY_COMPARE(mClient->msgids.count(), 1);
+    QCOMPARE(rawMsgid(raw, 0), int(KGameMessage::IdCompressed));
+    QVERIFY(raw.at(0).at(0).toByteArray().size() < msg.size());
+    QCOMPARE(mClient->msgids.at(0), userMsgid);
+    QCOMPARE(mClient->messages.at(0), msg);
+}
+
+void tst_KGameNetwork::threshold()
+{
+    QSignalSpy raw(mClient->messageClient(), SIGNAL(forwardReceived(QByteArray,quint32,QList<quint32>)));
+    mMaster->setPeerCapabilities(mClient->gameId(), KGameMessage::CapCompression);
+    QCOMPARE(mMaster->compressionThreshold(), 4096);
+
+    QList<QByteArray> sent;
+    QList<int> expected;
+
+    // below the default threshold
+    sent << compressibleData(1000);
+    expected << userMsgid;
+    QVERIFY(mMaster->sendSystemMessage(sent.last(), userMsgid, mClient->gameId()));
+
+    // the same message with a lower threshold
+    mMaster->setCompressionThreshold(500);
+    sent << compressibleData(1000);
+    expected << KGameMessage::IdCompressed;
+    QVERIFY(mMaster->sendSystemMessage(sent.last(), userMsgid, mClient->gameId()));
+
+    // data which doesn't get smaller
+    sent << incompressibleData(100000);
+    expected << userMsgid;
+    QVERIFY(mMaster->sendSystemMessage(sent.last(), userMsgid, mClient->gameId()));
+
+    // compression switched off
+    mMaster->setCompressionThreshold(-1);
+    sent << compressibleData(100000);
+    expected << userMsgid;
+    QVERIFY(mMaster->sendSystemMessage(sent.last(), userMsgid, mClient->gameId()));
+
+    QTRY_COMPARE(mClient->msgids.count(), sent.count());
+    for (int i = 0; i < sent.count(); ++i) {
+        QCOMPARE(rawMsgid(raw, i), expected.at(i));
+        QCOMPARE(mClient->msgids.at(i), userMsgid);
+        QCOMPARE(mClient->messages.at(i), sent.at(i));
+    }
+}
+
+void tst_KGameNetwork::peerWithoutCapability()
+{
+    QSignalSpy raw(mClient->messageClient(), SIGNAL(forwardReceived(QByteArray,quint32,QList<quint32>)));
+
+    // the capability of another peer doesn't count
+    mMaster->setPeerCapabilities(mClient->gameId() + 1, KGameMessage::CapCompression);
+
+    const QByteArray msg = compressibleData(100000);
+    QVERIFY(mMaster->sendSystemMessage(msg, userMsgid, mClient->gameId()));
+    QTRY_COMPARE(mClient->msgids.count(), 1);
+    QCOMPARE(rawMsgid(raw, 0), userMsgid);
+    QCOMPARE(mClient->msgids.at(0), userMsgid);
+    QCOMPARE(mClient->messages.at(0), msg);
+}
+
+void tst_KGameNetwork::gameSetup()
+{
+    TestGame master;
+    TestGame client;
+    QSignalSpy masterJoined(&master, SIGNAL(signalClientJoinedGame(quint32,KGame*)));
+    QSignalSpy clientJoined(&client, SIGNAL(signalClientJoinedGame(quint32,KGame*)));
+    QVERIFY(master.offerConnections(0));
+    QVERIFY(client.connectToServer(QStringLiteral("127.0.0.1"), master.port()));
+    QTRY_COMPARE(masterJoined.count(), 1);
+    QTRY_COMPARE(clientJoined.count(), 1);
+
+    QSignalSpy masterRaw(master.messageClient(), SIGNAL(forwardReceived(QByteArray,quint32,QList<quint32>)));
+    QSignalSpy clientRaw(client.messageClient(), SIGNAL(forwardReceived(QByteArray,quint32,QList<quint32>)));
+    QSignalSpy masterData(&master, SIGNAL(signalNetworkData(int,QByteArray,quint32,quint32)));
+    QSignalSpy clientData(&client, SIGNAL(signalNetworkData(int,QByteArray,quint32,quint32)));
+
+    const QByteArray msg = compressibleData(100000);
+    QVERIFY(master.sendMessage(msg, 1, client.gameId()));
+    QVERIFY(client.sendMessage(msg, 2, master.gameId()));
+
+    QTRY_COMPARE(clientData.count(), 1);
+    QCOMPARE(rawMsgid(clientRaw, clientRaw.count() - 1), int(KGameMessage::IdCompressed));
+    QCOMPARE(clientData.at(0).at(0).toInt(), 1);
+    QCOMPARE(clientData.at(0).at(1).toByteArray(), msg);
+
+    QTRY_COMPARE(masterData.count(), 1);
+    QCOMPARE(rawMsgid(masterRaw, masterRaw.count() - 1), int(KGameMessage::IdCompressed));
+    QCOMPARE(masterData.at(0).at(0).toInt(), 2);
+    QCOMPARE(masterData.at(0).at(1).toByteArray(), msg);
+}
+
+void tst_KGameNetwork::oldMaster()
+{
+    connect(mMaster, SIGNAL(signalClientConnected(quint32)), mMaster, SLOT(setupOldClient(quint32)));
+    TestGame client;
+    QVERIFY(client.connectToServer(QStringLiteral("127.0.0.1"), mMaster->port()));
+    QTRY_VERIFY(mMaster->msgids.contains(KGameMessage::IdSetupGameContinue));
+
+    QSignalSpy raw(mMaster->messageClient(), SIGNAL(forwardReceived(QByteArray,quint32,QList<quint32>)));
+    const int received = mMaster->msgids.count();
+    const QByteArray msg = compressibleData(100000);
+    QVERIFY(client.sendMessage(msg, 1, mMaster->gameId()));
+    QTRY_COMPARE(mMaster->msgids.count(), received + 1);
+    QCOMPARE(rawMsgid(raw, raw.count() - 1), userMsgid);
+    QCOMPARE(mMaster->msgids.last(), userMsgid);
+    QCOMPARE(mMaster->messages.last(), msg);
+}
+
+QTEST_MAIN(tst_KGameNetwork)
+
+#include "kgamenetworktest.moc"
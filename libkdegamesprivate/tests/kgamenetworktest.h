@@ -0,0 +1,78 @@
+#ifndef KGAMENETWORKTEST_H
+#define KGAMENETWORKTEST_H
+
+#include <QObject>
+#include <QDataStream>
+
+#define USE_UNSTABLE_LIBKDEGAMESPRIVATE_API
+#include "kgame/kgame.h"
+#include "kgame/kgamenetwork.h"
+
+/// @brief A network which records the messages it receives
+class TestNetwork : public KGameNetwork
+{
+    Q_OBJECT
+
+public:
+    explicit TestNetwork(QObject* parent = 0) : KGameNetwork(42, parent) {}
+
+    using KGameNetwork::setPeerCapabilities;
+
+    QList<int> msgids;
+    QList<QByteArray> messages;
+
+public slots:
+    /// @brief Send the setup of a master which doesn't announce any capabilities
+    void setupOldClient(quint32 clientID);
+
+protected:
+    void networkTransmission(QDataStream& stream, int msgid, quint32 receiver, quint32 sender, quint32 clientID);
+};
+
+/// @brief A game without any players
+class TestGame : public KGame
+{
+    Q_OBJECT
+
+public:
+    explicit TestGame(QObject* parent = 0) : KGame(42, parent) {}
+
+protected:
+    bool playerInput(QDataStream&, KPlayer*) { return false; }
+};
+
+/// @brief A test class for the compression of KGameNetwork messages
+class tst_KGameNetwork : public QObject
+{
+    Q_OBJECT
+
+// Declare test functions as private slots, or they won't get executed
+private slots:
+
+    /// @brief Connect two networks to each other
+    void init();
+
+    /// @brief Disconnect the networks again
+    void cleanup();
+
+    /// @brief Check that a compressed message arrives with its original id and data
+    void roundTrip();
+
+    /// @brief Check that only messages above the threshold which shrink get compressed
+    void threshold();
+
+    /// @brief Check that a peer which never announced CapCompression gets uncompressed data
+    void peerWithoutCapability();
+
+    /// @brief Check that two games announce CapCompression to each other during the setup
+    void gameSetup();
+
+    /// @brief Check that a game doesn't compress for a master without the capability byte
+    void oldMaster();
+
+private:
+    TestNetwork* mMaster;
+    TestNetwork* mClient;
+};
+
+#endif // KGAMENETWORKTEST_H
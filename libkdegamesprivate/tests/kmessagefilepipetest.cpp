@@ -0,0 +1,126 @@
+#include <QtTest>
+#include <QtEndian>
+
+#include "kmessagefilepipetest.h"
+
+static const quint32 messageCookie = 0x4242aeae;
+static const quint32 helloCookie = 0x4242aeb1;
+
+// a frame with the fixed-width header
+static QByteArray frame(const QByteArray& msg, quint32 cookie = messageCookie, quint32 size = 0)
+{
+    uchar header[8];
+    qToBigEndian<quint32>(cookie, header);
+    qToBigEndian<quint32>(size ? size : msg.size() + 8, header + 4);
+    return QByteArray((const char*)header, sizeof(header)) + msg;
+}
+
+// a frame with the old header of two native longs
+static QByteArray legacyFrame(const QByteArray& msg)
+{
+    const long header[2] = { long(messageCookie), long(msg.size() + sizeof(header)) };
+    return QByteArray((const char*)header, sizeof(header)) + msg;
+}
+
+// the messages received by a spy on KMessageIO::received
+static QList<QByteArray> messages(const QSignalSpy& spy)
+{
+    QList<QByteArray> result;
+    for (int i = 0; i < spy.count(); ++i)
+        result << spy.at(i).at(0).toByteArray();
+    return result;
+}
+
+void tst_KMessageFilePipe::init()
+{
+    mInput.clear();
+    mOutput.clear();
+    mReadBuffer.setBuffer(&mInput);
+    mWriteBuffer.setBuffer(&mOutput);
+    QVERIFY(mReadBuffer.open(QIODevice::ReadOnly));
+    QVERIFY(mWriteBuffer.open(QIODevice::WriteOnly));
+    mPipe = new KMessageFilePipe(this, &mReadBuffer, &mWriteBuffer);
+    QVERIFY(mPipe->isConnected());
+}
+
+void tst_KMessageFilePipe::cleanup()
+{
+    delete mPipe;
+    mReadBuffer.close();
+    mWriteBuffer.close();
+}
+
+void tst_KMessageFilePipe::feed(const QByteArray& data)
+{
+    mInput.append(data);
+    while (mReadBuffer.bytesAvailable() > 0)
+        mPipe->exec();
+}
+
+void tst_KMessageFilePipe::writtenFrames()
+{
+    // the hello frame offers the shared memory
+    const QByteArray hello = frame(QByteArray("\0\0\0\1", 4), helloCookie);
+    QCOMPARE(mOutput, hello);
+    mPipe->send("abc");
+    QCOMPARE(mOutput, hello + frame("abc"));
+    QVERIFY(!mPipe->usesSharedMemory());
+}
+
+void tst_KMessageFilePipe::legacyFrames()
+{
+    QSignalSpy spy(mPipe, SIGNAL(received(QByteArray)));
+    feed(legacyFrame("old") + legacyFrame(QByteArray(5000, 'o')));
+    QCOMPARE(messages(spy), QList<QByteArray>() << "old" << QByteArray(5000, 'o'));
+
+    // once the parent uses the fixed-width header, the old one is garbage
+    feed(frame("new") + legacyFrame("stale") + frame("last"));
+    QCOMPARE(messages(spy), QList<QByteArray>() << "old" << QByteArray(5000, 'o') << "new" << "last");
+}
+
+void tst_KMessageFilePipe::garbage()
+{
+    QSignalSpy spy(mPipe, SIGNAL(received(QByteArray)));
+    feed(QByteArray("xyz\x01\x02", 5) + frame("one") + QByteArray("garbage\0", 8) + frame("two"));
+    QCOMPARE(messages(spy), QList<QByteArray>() << "one" << "two");
+
+    // the first byte of the cookie in the garbage and a frame of an unknown
+    // kind, which is skipped as a whole
+    feed(QByteArray("--\x42\x42\x01--", 7) + frame("ignored", 0x4242aeff) + frame("three"));
+    QCOMPARE(messages(spy), QList<QByteArray>() << "one" << "two" << "three");
+}
+
+void tst_KMessageFilePipe::splitMessage()
+{
+    QSignalSpy spy(mPipe, SIGNAL(received(QByteArray)));
+    QByteArray msg(100000, 'x');
+    for (int i = 0; i < msg.size(); ++i)
+        msg[i] = char('a' + i % 26);
+    const QByteArray data = frame(msg) + frame("next");
+
+    // split inside the header, inside the message and between the messages
+    const int splits[] = { 3, 5000, data.size() - 9, data.size() };
+    int written = 0;
+    for (unsigned i = 0; i < sizeof(splits) / sizeof(splits[0]); ++i) {
+        feed(data.mid(written, splits[i] - written));
+        written = splits[i];
+        if (written < data.size() - 9)
+            QCOMPARE(spy.count(), 0);
+    }
+    QCOMPARE(messages(spy), QList<QByteArray>() << msg << "next");
+}
+
+void tst_KMessageFilePipe::oversizedMessage()
+{
+    QSignalSpy spy(mPipe, SIGNAL(received(QByteArray)));
+
+    // above the size limit of 64 MiB and below the size of the header
+    feed(frame("x", messageCookie, 64 * 1024 * 1024 + 1) + frame("one"));
+    feed(frame("y", messageCookie, 4) + frame("two"));
+    QCOMPARE(messages(spy), QList<QByteArray>() << "one" << "two");
+    QVERIFY(mPipe->isConnected());
+}
+
+QTEST_MAIN(tst_KMessageFilePipe)
+
+#include "kmessagefilepipetest.moc"
@@ -0,0 +1,48 @@
+#ifndef KMESSAGEFILEPIPETEST_H
+#define KMESSAGEFILEPIPETEST_H
+
+#include <QObject>
+#include <QBuffer>
+
+#define USE_UNSTABLE_LIBKDEGAMESPRIVATE_API
+#include "kgame/kmessageio.h"
+
+class tst_KMessageFilePipe : public QObject
+{
+    Q_OBJECT
+
+// Declare test functions as private slots, or they won't get executed
+private slots:
+
+    /// @brief Open the buffers of both directions and create the pipe
+    void init();
+
+    /// @brief Delete the pipe and close the buffers
+    void cleanup();
+
+    /// @brief Check that the pipe announces and uses the fixed-width header
+    void writtenFrames();
+
+    /// @brief Check that frames with the old native long header are accepted until the first fixed-width one
+    void legacyFrames();
+
+    /// @brief Check that garbage and frames with unknown cookies between messages are skipped
+    void garbage();
+
+    /// @brief Check that a message split across several reads is received once complete
+    void splitMessage();
+
+    /// @brief Check that headers announcing impossible sizes are skipped
+    void oversizedMessage();
+
+private:
+    void feed(const QByteArray& data);
+
+    QByteArray mInput;
+    QByteArray mOutput;
+    QBuffer mReadBuffer;
+    QBuffer mWriteBuffer;
+    KMessageFilePipe* mPipe;
+};
+
+#endif // KMESSAGEFILEPIPETEST_H
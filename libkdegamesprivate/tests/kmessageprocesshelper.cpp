@@ -0,0 +1,27 @@
+// The child process of kmessageprocesstest: sends every message that it gets
+// from its parent back to it.
+
+#include <QCoreApplication>
+#include <QFile>
+
+#include <stdio.h>
+
+#define USE_UNSTABLE_LIBKDEGAMESPRIVATE_API
+#include "kgame/kmessageio.h"
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QFile input;
+    QFile output;
+    if (!input.open(fileno(stdin), QIODevice::ReadOnly | QIODevice::Unbuffered)
+        || !output.open(fileno(stdout), QIODevice::WriteOnly | QIODevice::Unbuffered))
+        return 1;
+
+    KMessageFilePipe pipe(0, &input, &output);
+    QObject::connect(&pipe, SIGNAL(received(QByteArray)), &pipe, SLOT(send(QByteArray)));
+    while (pipe.isConnected())
+        pipe.exec();
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include <QtTest>
+#include <QSharedMemory>
+
+#include "kmessageprocesstest.h"
+
+// the messages received by a spy on KMessageIO::received
+static QList<QByteArray> messages(const QSignalSpy& spy)
+{
+    QList<QByteArray> result;
+    for (int i = 0; i < spy.count(); ++i)
+        result << spy.at(i).at(0).toByteArray();
+    return result;
+}
+
+static QByteArray pattern(int size, int seed)
+{
+    QByteArray msg(size, Qt::Uninitialized);
+    for (int i = 0; i < size; ++i)
+        msg[i] = char('a' + (i + seed) % 26);
+    return msg;
+}
+
+void tst_KMessageProcess::init()
+{
+    mProcess = new KMessageProcess(this, QLatin1String(KMESSAGEPROCESSHELPER));
+}
+
+void tst_KMessageProcess::cleanup()
+{
+    delete mProcess;
+}
+
+void tst_KMessageProcess::echo()
+{
+    QSignalSpy spy(mProcess, SIGNAL(received(QByteArray)));
+    QList<QByteArray> sent;
+    sent << "one" << "two" << QByteArray(100, 'x') << "";
+    foreach (const QByteArray& msg, sent)
+        mProcess->send(msg);
+    QTRY_COMPARE(spy.count(), sent.count());
+    QCOMPARE(messages(spy), sent);
+    QVERIFY(mProcess->isConnected());
+}
+
+void tst_KMessageProcess::sharedMemory()
+{
+    QSharedMemory probe(QLatin1String("kmessageprocesstest-probe"));
+    if (!probe.create(1024))
+        QSKIP("Shared memory is not available");
+    probe.detach();
+
+    // the segment is only created after the helper announced that it can use it
+    QVERIFY(!mProcess->usesSharedMemory());
+    QTRY_VERIFY(mProcess->usesSharedMemory());
+
+    // one at a time, so that the rings wrap around
+    QSignalSpy spy(mProcess, SIGNAL(received(QByteArray)));
+    for (int i = 0; i < 10; ++i) {
+        const QByteArray msg = pattern(300 * 1024 + i, i);
+        mProcess->send(msg);
+        QTRY_COMPARE_WITH_TIMEOUT(spy.count(), i + 1, 10000);
+        QCOMPARE(spy.at(i).at(0).toByteArray(), msg);
+    }
+
+    // all at once, so that some messages don't fit into the rings and go
+    // through the pipes instead, one of them is even larger than a ring
+    spy.clear();
+    QList<QByteArray> sent;
+    sent << pattern(5000, 0) << pattern(2 * 1024 * 1024, 1);
+    for (int i = 0; i < 10; ++i)
+        sent << pattern(300 * 1024 + i, i) << QByteArray("small");
+    foreach (const QByteArray& msg, sent)
+        mProcess->send(msg);
+    QTRY_COMPARE_WITH_TIMEOUT(spy.count(), sent.count(), 30000);
+    QCOMPARE(messages(spy), sent);
+}
+
+QTEST_MAIN(tst_KMessageProcess)
+
+#include "kmessageprocesstest.moc"
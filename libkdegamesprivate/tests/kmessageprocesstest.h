@@ -0,0 +1,32 @@
+#ifndef KMESSAGEPROCESSTEST_H
+#define KMESSAGEPROCESSTEST_H
+
+#include <QObject>
+
+#define USE_UNSTABLE_LIBKDEGAMESPRIVATE_API
+#include "kgame/kmessageio.h"
+
+class tst_KMessageProcess : public QObject
+{
+    Q_OBJECT
+
+// Declare test functions as private slots, or they won't get executed
+private slots:
+
+    /// @brief Start the helper process, which echoes every message
+    void init();
+
+    /// @brief Stop the helper process
+    void cleanup();
+
+    /// @brief Check that small messages are echoed through the pipes
+    void echo();
+
+    /// @brief Check that large messages are echoed through the shared memory, also when they don't fit into it
+    void sharedMemory();
+
+private:
+    KMessageProcess* mProcess;
+};
+
+#endif // KMESSAGEPROCESSTEST_H
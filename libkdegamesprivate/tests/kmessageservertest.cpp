@@ -0,0 +1,219 @@
+#include <QtTest>
+
+#include "kmessageservertest.h"
+
+static const int clientCount = 4;
+
+void tst_KMessageServer::initTestCase()
+{
+    qRegisterMetaType<QList<quint32> >("QList<quint32>");
+
+    mRelay.start(QStringLiteral(KGAME_RELAYD), QStringList() << QStringLiteral("--port") << QStringLiteral("0") << QStringLiteral("--stats-interval") << QStringLiteral("0"));
+    QVERIFY(mRelay.waitForStarted());
+    QVERIFY(mRelay.waitForReadyRead());
+    const QString line = QString::fromLatin1(mRelay.readLine()).trimmed();
+    QVERIFY2(line.contains(QLatin1String("listening on port ")), qPrintable(line));
+    const quint16 port = line.section(QLatin1Char(' '), -1).toUShort();
+    QVERIFY(port != 0);
+
+    for (int i = 0; i < clientCount; ++i) {
+        KMessageClient* client = new KMessageClient(this);
+        client->setServer(QStringLiteral("127.0.0.1"), port);
+        QVERIFY(client->isConnected());
+        mClients << client;
+    }
+    for (int i = 0; i < clientCount; ++i)
+        QTRY_VERIFY(mClients[i]->id() != 0);
+}
+
+void tst_KMessageServer::cleanupTestCase()
+{
+    qDeleteAll(mClients);
+    mClients.clear();
+    mRelay.kill();
+    mRelay.waitForFinished();
+}
+
+void tst_KMessageServer::broadcast()
+{
+    QList<QSignalSpy*> spies;
+    for (int i = 0; i < clientCount; ++i)
+        spies << new QSignalSpy(mClients[i], SIGNAL(broadcastReceived(QByteArray,quint32)));
+
+    const QByteArray msg("broadcast");
+    mClients[1]->sendBroadcast(msg);
+    for (int i = 0; i < clientCount; ++i) {
+        QTRY_COMPARE(spies[i]->count(), 1);
+        QCOMPARE(spies[i]->at(0).at(0).toByteArray(), msg);
+        QCOMPARE(spies[i]->at(0).at(1).value<quint32>(), mClients[1]->id());
+    }
+
+    qDeleteAll(spies);
+}
+
+void tst_KMessageServer::forward()
+{
+    QList<QSignalSpy*> spies;
+    for (int i = 0; i < clientCount; ++i)
+        spies << new QSignalSpy(mClients[i], SIGNAL(forwardReceived(QByteArray,quint32,QList<quint32>)));
+
+    const QByteArray msg("forward");
+    const QList<quint32> receivers = QList<quint32>() << mClients[0]->id() << mClients[3]->id();
+    mClients[2]->sendForward(msg, receivers);
+    QTRY_COMPARE(spies[0]->count(), 1);
+    QTRY_COMPARE(spies[3]->count(), 1);
+    QCOMPARE(spies[0]->at(0).at(0).toByteArray(), msg);
+    QCOMPARE(spies[0]->at(0).at(1).value<quint32>(), mClients[2]->id());
+    QCOMPARE(spies[0]->at(0).at(2).value<QList<quint32> >(), receivers);
+
+    // anything sent to the others would have arrived before this broadcast
+    QSignalSpy marker(mClients[1], SIGNAL(broadcastReceived(QByteArray,quint32)));
+    mClients[2]->sendBroadcast(QByteArray("marker"));
+    QTRY_COMPARE(marker.count(), 1);
+    QCOMPARE(spies[1]->count(), 0);
+    QCOMPARE(spies[2]->count(), 0);
+
+    qDeleteAll(spies);
+}
+
+void tst_KMessageServer::largeMessage()
+{
+    QByteArray msg(4 * 1024 * 1024, '\0');
+    for (int i = 0; i < msg.size(); ++i)
+        msg[i] = char(i * 31 + i / 4096);
+
+    QSignalSpy spy(mClients[3], SIGNAL(forwardReceived(QByteArray,quint32,QList<quint32>)));
+    mClients[0]->sendForward(msg, mClients[3]->id());
+    QTRY_COMPARE_WITH_TIMEOUT(spy.count(), 1, 20000);
+    QCOMPARE(spy.at(0).at(0).toByteArray(), msg);
+}
+
+void tst_KMessageServer::manyMessages()
+{
+    const int messageCount = 2000;
+    QSignalSpy spy(mClients[1], SIGNAL(broadcastReceived(QByteArray,quint32)));
+    for (int i = 0; i < messageCount; ++i)
+        mClients[i % clientCount]->sendBroadcast(QByteArray::number(i));
+
+    QTRY_COMPARE_WITH_TIMEOUT(spy.count(), messageCount, 20000);
+    // the messages of each sender arrive in the order they were sent
+    QHash<quint32, int> last;
+    for (int i = 0; i < messageCount; ++i) {
+        const int number = spy.at(i).at(0).toByteArray().toInt();
+        const quint32 sender = spy.at(i).at(1).value<quint32>();
+        QCOMPARE(sender, mClients[number % clientCount]->id());
+        QVERIFY(number > last.value(sender, -1));
+        last[sender] = number;
+    }
+}
+
+void tst_KMessageServer::sendBeforeDisconnect()
+{
+    KMessageClient* client = new KMessageClient(this);
+    client->setServer(QStringLiteral("127.0.0.1"), mClients[0]->peerPort());
+    QTRY_VERIFY(client->id() != 0);
+
+    QSignalSpy spy(mClients[0], SIGNAL(broadcastReceived(QByteArray,quint32)));
+    const QByteArray msg("goodbye");
+    client->sendBroadcast(msg);
+    delete client;
+    QTRY_COMPARE(spy.count(), 1);
+    QCOMPARE(spy.at(0).at(0).toByteArray(), msg);
+}
+
+void tst_KMessageServer::clientOrder()
+{
+    QList<KMessageClient*> extra;
+    for (int i = 0; i < 3; ++i) {
+        KMessageClient* client = new KMessageClient(this);
+        client->setServer(QStringLiteral("127.0.0.1"), mClients[0]->peerPort());
+        QTRY_VERIFY(client->id() != 0);
+        extra << client;
+    }
+    QList<quint32> expected;
+    for (int i = 0; i < clientCount; ++i)
+        expected << mClients[i]->id();
+    expected << extra[0]->id() << extra[1]->id() << extra[2]->id();
+    QTRY_COMPARE(mClients[0]->clientList(), expected);
+
+    // the one in the middle leaves, the others keep their order
+    expected.removeAll(extra[1]->id());
+    delete extra.takeAt(1);
+    QTRY_COMPARE(mClients[0]->clientList(), expected);
+
+    // a new client gets the list from the server, in the same order
+    KMessageClient* client = new KMessageClient(this);
+    client->setServer(QStringLiteral("127.0.0.1"), mClients[0]->peerPort());
+    QTRY_VERIFY(client->id() != 0);
+    extra << client;
+    expected << client->id();
+    QTRY_COMPARE(client->clientList(), expected);
+    QTRY_COMPARE(mClients[0]->clientList(), expected);
+
+    qDeleteAll(extra);
+}
+
+void tst_KMessageServer::networkThread()
+{
+    KMessageServer* server = new KMessageServer;
+    QVERIFY(server->initNetwork(0));
+    QVERIFY(server->startNetworkThread());
+    QVERIFY(server->isUsingNetworkThread());
+    QVERIFY(server->serverPort() != 0);
+
+    // the server end of the local client is created in this thread
+    KMessageClient local;
+    local.setServer(server);
+    KMessageClient* remote = new KMessageClient;
+    remote->setServer(QStringLiteral("127.0.0.1"), server->serverPort());
+    QTRY_VERIFY(local.id() != 0);
+    QTRY_VERIFY(remote->id() != 0);
+    QTRY_COMPARE(local.clientList().count(), 2);
+    QTRY_COMPARE(remote->clientList().count(), 2);
+    QCOMPARE(server->clientIDs(), QList<quint32>() << local.id() << remote->id());
+    QCOMPARE(server->clientCount(), 2);
+    QCOMPARE(server->adminID(), local.id());
+
+    QSignalSpy localBroadcast(&local, SIGNAL(broadcastReceived(QByteArray,quint32)));
+    QSignalSpy remoteBroadcast(remote, SIGNAL(broadcastReceived(QByteArray,quint32)));
+    remote->sendBroadcast(QByteArray("broadcast"));
+    QTRY_COMPARE(localBroadcast.count(), 1);
+    QTRY_COMPARE(remoteBroadcast.count(), 1);
+    QCOMPARE(localBroadcast.at(0).at(0).toByteArray(), QByteArray("broadcast"));
+    QCOMPARE(localBroadcast.at(0).at(1).value<quint32>(), remote->id());
+
+    QSignalSpy remoteForward(remote, SIGNAL(forwardReceived(QByteArray,quint32,QList<quint32>)));
+    local.sendForward(QByteArray("forward"), remote->id());
+    QTRY_COMPARE(remoteForward.count(), 1);
+    QCOMPARE(remoteForward.at(0).at(0).toByteArray(), QByteArray("forward"));
+    QCOMPARE(remoteForward.at(0).at(1).value<quint32>(), local.id());
+
+    QSignalSpy disconnected(&local, SIGNAL(eventClientDisconnected(quint32,bool)));
+    const quint32 remoteId = remote->id();
+    delete remote;
+    QTRY_COMPARE(disconnected.count(), 1);
+    QCOMPARE(disconnected.at(0).at(0).value<quint32>(), remoteId);
+    QCOMPARE(server->clientIDs(), QList<quint32>() << local.id());
+
+    // the server and its clients come back to this thread
+    server->stopNetworkThread();
+    QVERIFY(!server->isUsingNetworkThread());
+    QCOMPARE(server->thread(), QThread::currentThread());
+    QCOMPARE(server->findClient(local.id())->thread(), QThread::currentThread());
+    localBroadcast.clear();
+    local.sendBroadcast(QByteArray("back"));
+    QTRY_COMPARE(localBroadcast.count(), 1);
+    QCOMPARE(localBroadcast.at(0).at(0).toByteArray(), QByteArray("back"));
+
+    // deleting the clients from another thread
+    QSignalSpy broken(&local, SIGNAL(connectionBroken()));
+    QVERIFY(server->startNetworkThread());
+    server->deleteClients();
+    QTRY_COMPARE(broken.count(), 1);
+    QCOMPARE(server->clientCount(), 0);
+    delete server;
+}
+
+QTEST_MAIN(tst_KMessageServer)
+
+#include "kmessageservertest.moc"
@@ -0,0 +1,50 @@
+#ifndef KMESSAGESERVERTEST_H
+#define KMESSAGESERVERTEST_H
+
+#include <QObject>
+#include <QProcess>
+
+#define USE_UNSTABLE_LIBKDEGAMESPRIVATE_API
+#include "kgame/kmessageclient.h"
+#include "kgame/kmessageserver.h"
+
+class tst_KMessageServer : public QObject
+{
+    Q_OBJECT
+
+// Declare test functions as private slots, or they won't get executed
+private slots:
+
+    /// @brief Start kgame-relayd and connect several clients to it
+    void initTestCase();
+
+    /// @brief Disconnect the clients and stop kgame-relayd
+    void cleanupTestCase();
+
+    /// @brief Check that a broadcast reaches every client, including the sender
+    void broadcast();
+
+    /// @brief Check that a forward only reaches the given clients
+    void forward();
+
+    /// @brief Check that a message of several megabytes is relayed unchanged
+    void largeMessage();
+
+    /// @brief Check that many small messages are relayed completely and in order
+    void manyMessages();
+
+    /// @brief Check that the messages sent right before a client disconnects are delivered
+    void sendBeforeDisconnect();
+
+    /// @brief Check that the client lists stay in the order of connecting when a client leaves
+    void clientOrder();
+
+    /// @brief Check routing and client removal of a server in its own network thread
+    void networkThread();
+
+private:
+    QProcess mRelay;
+    QList<KMessageClient*> mClients;
+};
+
+#endif // KMESSAGESERVERTEST_H
@@ -0,0 +1,98 @@
+#include <QtTest>
+#include <QtEndian>
+
+#include "kmessagesockettest.h"
+
+// a message as written by KMessageSocket::send
+static QByteArray frame(const QByteArray& msg)
+{
+    uchar header[5];
+    header[0] = 'M';
+    qToBigEndian<quint32>(msg.size(), header + 1);
+    return QByteArray((const char*)header, sizeof(header)) + msg;
+}
+
+// the messages received by a spy on KMessageIO::received
+static QList<QByteArray> messages(const QSignalSpy& spy)
+{
+    QList<QByteArray> result;
+    for (int i = 0; i < spy.count(); ++i)
+        result << spy.at(i).at(0).toByteArray();
+    return result;
+}
+
+void tst_KMessageSocket::init()
+{
+    QVERIFY(mServer.listen(QHostAddress::LocalHost));
+    mRaw = new QTcpSocket(this);
+    mRaw->connectToHost(QHostAddress::LocalHost, mServer.serverPort());
+    QVERIFY(mServer.waitForNewConnection(5000));
+    QVERIFY(mRaw->waitForConnected(5000));
+    mSocket = new KMessageSocket(mServer.nextPendingConnection(), this);
+    QVERIFY(mSocket->isConnected());
+}
+
+void tst_KMessageSocket::cleanup()
+{
+    delete mSocket;
+    delete mRaw;
+    mServer.close();
+}
+
+void tst_KMessageSocket::writeRaw(const QByteArray& data)
+{
+    mRaw->write(data);
+    QVERIFY(mRaw->waitForBytesWritten(5000));
+}
+
+void tst_KMessageSocket::garbage()
+{
+    QSignalSpy spy(mSocket, SIGNAL(received(QByteArray)));
+    writeRaw(QByteArray("xyz\x01\x02", 5) + frame("one") + QByteArray("garbage\0", 8) + frame("two"));
+    QTRY_COMPARE(spy.count(), 2);
+    QCOMPARE(messages(spy), QList<QByteArray>() << "one" << "two");
+
+    // a magic number in the garbage which doesn't start a message
+    writeRaw(QByteArray("--M\xff\xff\xff\xff--", 9) + frame("three"));
+    QTRY_COMPARE(spy.count(), 3);
+    QCOMPARE(spy.at(2).at(0).toByteArray(), QByteArray("three"));
+}
+
+void tst_KMessageSocket::splitMessage()
+{
+    QSignalSpy spy(mSocket, SIGNAL(received(QByteArray)));
+    QByteArray msg(100000, 'x');
+    for (int i = 0; i < msg.size(); ++i)
+        msg[i] = char('a' + i % 26);
+    const QByteArray data = frame(msg) + frame("next");
+
+    // split inside the header, inside the message and between the messages
+    const int splits[] = { 3, 5000, data.size() - 9, data.size() };
+    int written = 0;
+    for (unsigned i = 0; i < sizeof(splits) / sizeof(splits[0]); ++i) {
+        writeRaw(data.mid(written, splits[i] - written));
+        written = splits[i];
+        QTest::qWait(50);
+        if (written < data.size() - 9)
+            QCOMPARE(spy.count(), 0);
+    }
+    QTRY_COMPARE(spy.count(), 2);
+    QCOMPARE(messages(spy), QList<QByteArray>() << msg << "next");
+}
+
+void tst_KMessageSocket::oversizedMessage()
+{
+    mSocket->setMaxMessageSize(100);
+    QCOMPARE(mSocket->maxMessageSize(), quint32(100));
+    QSignalSpy spy(mSocket, SIGNAL(received(QByteArray)));
+
+    const QByteArray limit(100, 'l');
+    writeRaw(frame(QByteArray(1000, 'x')) + frame(limit) + frame(QByteArray(101, 'y')) + frame("ok"));
+    QTRY_COMPARE(spy.count(), 2);
+    QTest::qWait(50);
+    QCOMPARE(messages(spy), QList<QByteArray>() << limit << "ok");
+}
+
+QTEST_MAIN(tst_KMessageSocket)
+
+#include "kmessagesockettest.moc"
@@ -0,0 +1,40 @@
+#ifndef KMESSAGESOCKETTEST_H
+#define KMESSAGESOCKETTEST_H
+
+#include <QObject>
+#include <QTcpServer>
+
+#define USE_UNSTABLE_LIBKDEGAMESPRIVATE_API
+#include "kgame/kmessageio.h"
+
+class tst_KMessageSocket : public QObject
+{
+    Q_OBJECT
+
+// Declare test functions as private slots, or they won't get executed
+private slots:
+
+    /// @brief Connect a raw socket to a KMessageSocket
+    void init();
+
+    /// @brief Close both ends of the connection
+    void cleanup();
+
+    /// @brief Check that garbage between messages is skipped
+    void garbage();
+
+    /// @brief Check that a message split across several reads is received once complete
+    void splitMessage();
+
+    /// @brief Check that headers announcing messages above maxMessageSize are skipped
+    void oversizedMessage();
+
+private:
+    void writeRaw(const QByteArray& data);
+
+    QTcpServer mServer;
+    QTcpSocket* mRaw;
+    KMessageSocket* mSocket;
+};
+
+#endif // KMESSAGESOCKETTEST_H
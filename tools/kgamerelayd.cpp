@@ -0,0 +1,128 @@
+/***************************************************************************
+ *   Copyright 2014 KDE Games Team <kde-games-devel@kde.org>               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License          *
+ *   version 2 as published by the Free Software Foundation                *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+//kgame-relayd hosts KMessageServers without a game, so that the clients of
+//a network game (e.g. KGame objects calling connectToServer) can meet on a
+//headless machine. Every server relays one match. Usage example:
+//
+//  kgame-relayd --port 7654 --servers 10 --stats-interval 60
+//
+//This starts ten servers on the ports 7654 to 7663 and prints their
+//statistics every minute.
+
+#include "libkdegamesprivate/kgame/kmessageserver.h"
+
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QTextStream>
+#include <QtCore/QTimer>
+
+static QTextStream& out()
+{
+	static QTextStream stream(stdout);
+	return stream;
+}
+
+static QTextStream& err()
+{
+	static QTextStream stream(stderr);
+	return stream;
+}
+
+class RelayStatistics : public QObject
+{
+	Q_OBJECT
+	public:
+		RelayStatistics(const QList<KMessageServer*>& servers) : m_servers(servers) {}
+	public Q_SLOTS:
+		void report()
+		{
+			for (int i = 0; i < m_servers.count(); ++i)
+			{
+				const KMessageServer* server = m_servers[i];
+				out() << "Server " << i << " (port " << server->serverPort() << "): "
+					<< server->clientCount() << " clients, received "
+					<< server->receivedMessageCount() << " messages ("
+					<< server->receivedByteCount() << " bytes), sent "
+					<< server->sentMessageCount() << " messages ("
+					<< server->sentByteCount() << " bytes)\n";
+			}
+			out().flush();
+		}
+	private:
+		QList<KMessageServer*> m_servers;
+};
+
+int main(int argc, char** argv)
+{
+	QCoreApplication app(argc, argv);
+	app.setApplicationName(QLatin1String("kgame-relayd"));
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription(QLatin1String("Relays the messages of KGame network games."));
+	parser.addHelpOption();
+	const QCommandLineOption portOption(QLatin1String("port"), QLatin1String("Port of the first server, the others use the following ports (default: 0, i.e. any free port)."), QLatin1String("port"), QLatin1String("0"));
+	const QCommandLineOption serversOption(QLatin1String("servers"), QLatin1String("Number of servers, i.e. of matches (default: 1)."), QLatin1String("count"), QLatin1String("1"));
+	const QCommandLineOption cookieOption(QLatin1String("cookie"), QLatin1String("Cookie of the game (default: 42)."), QLatin1String("cookie"), QLatin1String("42"));
+	const QCommandLineOption maxClientsOption(QLatin1String("max-clients"), QLatin1String("Maximum number of clients per server (default: -1, i.e. unlimited)."), QLatin1String("count"), QLatin1String("-1"));
+	const QCommandLineOption statsOption(QLatin1String("stats-interval"), QLatin1String("Print the statistics every this many seconds, 0 to disable (default: 60)."), QLatin1String("seconds"), QLatin1String("60"));
+	parser.addOption(portOption);
+	parser.addOption(serversOption);
+	parser.addOption(cookieOption);
+	parser.addOption(maxClientsOption);
+	parser.addOption(statsOption);
+	parser.process(app);
+
+	bool ok1, ok2, ok3, ok4, ok5;
+	const quint16 port = parser.value(portOption).toUShort(&ok1);
+	const int serverCount = parser.value(serversOption).toInt(&ok2);
+	const quint16 cookie = parser.value(cookieOption).toUShort(&ok3);
+	const int maxClients = parser.value(maxClientsOption).toInt(&ok4);
+	const int statsInterval = parser.value(statsOption).toInt(&ok5);
+	if (!ok1 || !ok2 || !ok3 || !ok4 || !ok5 || serverCount < 1 || statsInterval < 0)
+	{
+		err() << "Invalid arguments.\n";
+		return 1;
+	}
+
+	QList<KMessageServer*> servers;
+	for (int i = 0; i < serverCount; ++i)
+	{
+		KMessageServer* server = new KMessageServer(cookie, &app);
+		server->setMaxClients(maxClients);
+		if (!server->initNetwork(port == 0 ? 0 : port + i))
+		{
+			err() << "Could not listen on port " << (port == 0 ? 0 : port + i) << "\n";
+			return 1;
+		}
+		out() << "Server " << i << " listening on port " << server->serverPort() << "\n";
+		servers << server;
+	}
+	out().flush();
+
+	RelayStatistics statistics(servers);
+	QTimer timer;
+	if (statsInterval > 0)
+	{
+		QObject::connect(&timer, SIGNAL(timeout()), &statistics, SLOT(report()));
+		timer.start(statsInterval * 1000);
+	}
+	return app.exec();
+}
+
+#include "kgamerelayd.moc"
@@ -0,0 +1,180 @@
+/***************************************************************************
+ *   Copyright 2014 KDE Games Team <kde-games-devel@kde.org>               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License          *
+ *   version 2 as published by the Free Software Foundation                *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+//kgrbundle compiles a theme into a bundle which KGameRenderer memory-maps
+//instead of parsing the SVG file. Usage example:
+//
+//  kgrbundle --size 72x96 --size 144x192 themes/default.desktop card_1 card_2
+//
+//The bundle is written next to the SVG file of the theme unless --output is
+//given. The sprite keys and sizes should be those which the game requests
+//most often; everything else will still be rendered from the SVG file.
+//The pixels are stored in the byte order of this machine, so build bundles
+//on the architecture that will load them; others ignore the bundle.
+//
+//No display server is needed: unless QT_QPA_PLATFORM or -platform says
+//otherwise, kgrbundle uses the offscreen platform plugin.
+
+#include "kgamerendererbundle_p.h"
+#include "kgtheme.h"
+
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QDateTime>
+#include <QtCore/QFileInfo>
+#include <QtCore/QTextStream>
+#include <QtGui/QGuiApplication>
+#include <QtGui/QPainter>
+#include <QtSvg/QSvgRenderer>
+
+static QTextStream& err()
+{
+	static QTextStream stream(stderr);
+	return stream;
+}
+
+static bool parseSize(const QString& text, QSize* size)
+{
+	const QStringList parts = text.split(QLatin1Char('x'));
+	if (parts.count() != 2)
+	{
+		return false;
+	}
+	bool ok1, ok2;
+	*size = QSize(parts[0].toInt(&ok1), parts[1].toInt(&ok2));
+	return ok1 && ok2 && !size->isEmpty();
+}
+
+int main(int argc, char** argv)
+{
+	//QGuiApplication is still needed for the fonts of text elements
+	if (qgetenv("QT_QPA_PLATFORM").isEmpty())
+	{
+		qputenv("QT_QPA_PLATFORM", "offscreen");
+	}
+	QGuiApplication app(argc, argv);
+	app.setApplicationName(QLatin1String("kgrbundle"));
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription(QLatin1String("Compiles a KGameRenderer theme into a precompiled bundle."));
+	parser.addHelpOption();
+	const QCommandLineOption sizeOption(QLatin1String("size"), QLatin1String("Pre-render sprites in this size (e.g. 72x96). Can be given multiple times."), QLatin1String("WxH"));
+	const QCommandLineOption suffixOption(QLatin1String("frame-suffix"), QLatin1String("Frame suffix used by the game (default: _%1)."), QLatin1String("suffix"), QLatin1String("_%1"));
+	const QCommandLineOption baseIndexOption(QLatin1String("frame-base-index"), QLatin1String("Frame base index used by the game (default: 0)."), QLatin1String("index"), QLatin1String("0"));
+	const QCommandLineOption outputOption(QLatin1String("output"), QLatin1String("Write the bundle to this file."), QLatin1String("file"));
+	parser.addOption(sizeOption);
+	parser.addOption(suffixOption);
+	parser.addOption(baseIndexOption);
+	parser.addOption(outputOption);
+	parser.addPositionalArgument(QLatin1String("theme"), QLatin1String("Theme description file (.desktop)"));
+	parser.addPositionalArgument(QLatin1String("keys"), QLatin1String("Sprite keys to include"), QLatin1String("[keys...]"));
+	parser.process(app);
+
+	QStringList args = parser.positionalArguments();
+	if (args.isEmpty())
+	{
+		parser.showHelp(1);
+	}
+	//read theme
+	KgTheme theme(QByteArray("kgrbundle"));
+	if (!theme.readFromDesktopFile(args.takeFirst()))
+	{
+		err() << "Could not read theme description.\n";
+		return 1;
+	}
+	QSvgRenderer renderer(theme.graphicsPath());
+	if (!renderer.isValid())
+	{
+		err() << "Could not load SVG file " << theme.graphicsPath() << "\n";
+		return 1;
+	}
+	QList<QSize> sizes;
+	foreach (const QString& text, parser.values(sizeOption))
+	{
+		QSize size;
+		if (!parseSize(text, &size))
+		{
+			err() << "Invalid size: " << text << "\n";
+			return 1;
+		}
+		sizes << size;
+	}
+
+	KGRInternal::BundleData data;
+	//same timestamp as computed by KGameRendererPrivate::setTheme
+	data.svgTimestamp = qMax(
+		QFileInfo(theme.graphicsPath()).lastModified().toTime_t(),
+		theme.property("_k_themeDescTimestamp").value<uint>()
+	);
+	data.frameSuffix = parser.value(suffixOption);
+	if (!data.frameSuffix.contains(QLatin1String("%1")))
+	{
+		data.frameSuffix = QLatin1String("_%1");
+	}
+	data.frameBaseIndex = parser.value(baseIndexOption).toInt();
+	const QString sizePrefix = QLatin1String("%1-%2-"); //see KGameRendererPrivate::m_sizePrefix
+
+	foreach (const QString& key, args)
+	{
+		//count frames like KGameRenderer::frameCount does
+		QStringList elementKeys;
+		int frame = data.frameBaseIndex;
+		while (renderer.elementExists(key + data.frameSuffix.arg(frame)))
+		{
+			elementKeys << key + data.frameSuffix.arg(frame);
+			++frame;
+		}
+		int count = frame - data.frameBaseIndex;
+		if (count == 0)
+		{
+			if (renderer.elementExists(key))
+			{
+				elementKeys << key;
+			}
+			else
+			{
+				err() << "Sprite does not exist: " << key << "\n";
+				count = -1;
+			}
+		}
+		data.frameCounts.insert(key, count);
+		//render elements
+		foreach (const QString& elementKey, elementKeys)
+		{
+			data.bounds.insert(elementKey, renderer.boundsOnElement(elementKey));
+			foreach (const QSize& size, sizes)
+			{
+				QImage image(size, QImage::Format_ARGB32_Premultiplied);
+				image.fill(Qt::transparent);
+				QPainter painter(&image);
+				renderer.render(&painter, elementKey);
+				painter.end();
+				data.images.insert(sizePrefix.arg(size.width()).arg(size.height()) + elementKey, image);
+			}
+		}
+	}
+
+	const QString outputPath = parser.isSet(outputOption)
+		? parser.value(outputOption)
+		: KGRInternal::ThemeBundle::pathForGraphics(theme.graphicsPath());
+	if (!KGRInternal::ThemeBundle::write(outputPath, data))
+	{
+		err() << "Could not write bundle to " << outputPath << "\n";
+		return 1;
+	}
+	return 0;
+}